@@ -4,22 +4,428 @@
 #include <vector>
 #include <fstream>
 #include <iostream>
+#include <cstring>
+#include <unordered_map>
+#include <functional>
+#include <sstream>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <memory>
+#include <random>
+#include <list>
+#include <climits>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
 using namespace std;
 
+// Trazas de eventos en formato Chrome trace (se abren en Perfetto o chrome://tracing).
+// Solo existen al compilar con -DDMV_TRACE; si no, TRACE_SCOPE no genera código.
+// Cada TRACE_SCOPE registra una zona desde su declaración hasta el final del bloque
+// y al salir del programa se escribe trace.json.
+#ifdef DMV_TRACE
+struct TraceEvent {
+    const char* name;
+    double start, duration;  // microsegundos
+    int thread;
+};
+
+mutex traceLock;
+vector<TraceEvent> traceEvents;
+const chrono::steady_clock::time_point traceOrigin = chrono::steady_clock::now();
+
+double traceNow() {
+    return chrono::duration<double, micro>(chrono::steady_clock::now() - traceOrigin).count();
+}
+
+int traceThreadId() {
+    static atomic<int> nextId(1);
+    thread_local int id = nextId++;
+    return id;
+}
+
+struct TraceZone {
+    const char* name;
+    double start;
+    TraceZone(const char* name) : name(name), start(traceNow()) {}
+    ~TraceZone() {
+        TraceEvent e = { name, start, traceNow() - start, traceThreadId() };
+        lock_guard<mutex> guard(traceLock);
+        traceEvents.push_back(e);
+    }
+};
+
+void traceWrite() {
+    lock_guard<mutex> guard(traceLock);
+    FILE* f = fopen("trace.json", "w");
+    if (!f) return;
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (size_t i = 0; i < traceEvents.size(); i++) {
+        const TraceEvent& e = traceEvents[i];
+        fprintf(f, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}%s\n",
+                e.name, e.thread, e.start, e.duration, i + 1 < traceEvents.size() ? "," : "");
+    }
+    fprintf(f, "]}\n");
+    fclose(f);
+    cout << "Traza guardada en trace.json (" << traceEvents.size() << " eventos)" << endl;
+}
+
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+#define TRACE_SCOPE(name) TraceZone TRACE_CONCAT(traceZone, __LINE__)(name)
+#else
+#define TRACE_SCOPE(name)
+#endif
+
 // Estructuras de datos
 struct Point {
     int x, y;
     Point(int x = 0, int y = 0) : x(x), y(y) {}
 };
 
+struct Flattening;
+
 struct Figure {
-    int type; // 0: recta directo, 1: recta DDA, 2: círculo incremental, 3: círculo PM, 4: elipse PM
+    int type; // 0: recta directo, 1: recta DDA, 2: círculo incremental, 3: círculo PM, 4: elipse PM,
+              // 5: polilínea, 6: Bézier cúbica (puntos p0 c1 c2 p1 c1 c2 p2 ...),
+              // 7: polígono relleno par-impar, 8: polígono relleno no nulo,
+              // 9: cubeta (semilla y tramos x0,y x1,y de la región rellenada),
+              // 10: elipse girada (centro, extremo del semieje a, punto a distancia b del eje),
+              // 11: arco de circunferencia (centro, inicio, dirección final; antihorario),
+              // 12: arco de elipse (los tres de la elipse girada, dirección inicial y final)
     vector<Point> points;
     float color[3];
     int thickness;
+    mutable shared_ptr<const Flattening> flattening;  // caché de la curva aplanada (Bézier)
+};
+
+// Lista persistente de figuras: vector de 32 ramas con cola (como el de Clojure).
+// Copiar una FigureList es O(1) y produce una instantánea que no cambia: los nodos se
+// comparten y solo se copian al modificarlos estando compartidos. Las copias se hacen
+// en el hilo de la ventana y luego se pueden leer desde otros hilos (autoguardado,
+// exportación) mientras la ventana sigue añadiendo figuras.
+//
+// Borrar en medio no desplaza nada: la figura deja un hueco en su posición física
+// (slot) y solo se copia el camino hasta su hoja. Cada nodo cuenta los huecos de su
+// subárbol para traducir posiciones a slots en O(log n); sin huecos la traducción es
+// la identidad. Los slots de las figuras vivas no cambian al borrar otras.
+const int FIGURE_NODE_BITS = 5;
+const size_t FIGURE_NODE_SIZE = 1 << FIGURE_NODE_BITS;
+const size_t FIGURE_NODE_MASK = FIGURE_NODE_SIZE - 1;
+
+struct FigureNode {
+    vector<shared_ptr<FigureNode>> children;  // nodos internos
+    vector<Figure> figures;                   // hojas y cola
+    unsigned dead = 0;                        // hojas y cola: un bit por hueco
+    size_t removed = 0;                       // huecos en todo el subárbol
+};
+typedef shared_ptr<FigureNode> FigureNodePtr;
+
+class FigureList {
+public:
+    class const_iterator {
+    public:
+        const_iterator(const FigureList* list, size_t slot) : list(list), slot(slot) { load(); skip(); }
+        const Figure& operator*() const { return node->figures[slot & FIGURE_NODE_MASK]; }
+        const Figure* operator->() const { return &node->figures[slot & FIGURE_NODE_MASK]; }
+        const_iterator& operator++() {
+            advance();
+            skip();
+            return *this;
+        }
+        bool operator!=(const const_iterator& other) const { return slot != other.slot; }
+    private:
+        void load() { node = slot < list->slots ? list->leafNode(slot).get() : nullptr; }
+        void advance() {
+            if ((++slot & FIGURE_NODE_MASK) == 0) load();
+        }
+        void skip() {
+            while (node && (node->dead >> (slot & FIGURE_NODE_MASK) & 1)) advance();
+        }
+        const FigureList* list;
+        size_t slot;
+        const FigureNode* node;
+    };
+
+    size_t size() const { return slots - holes(); }
+    bool empty() const { return size() == 0; }
+    const Figure& operator[](size_t i) const { return atSlot(slotOf(i)); }
+    const Figure& back() const { return (*this)[size() - 1]; }
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, slots); }
+
+    // Acceso por slot: [0, slotCount()) incluye los huecos
+    size_t slotCount() const { return slots; }
+    const Figure& atSlot(size_t s) const { return leafNode(s)->figures[s & FIGURE_NODE_MASK]; }
+    bool live(size_t s) const { return !(leafNode(s)->dead >> (s & FIGURE_NODE_MASK) & 1); }
+
+    // Slot de la figura en la posición i
+    size_t slotOf(size_t i) const {
+        if (!holes()) return i;
+        size_t offset = tailOffset(), treeLive = offset - (root ? root->removed : 0);
+        const FigureNode* node = tail.get();
+        size_t base = offset;
+        if (i < treeLive) {
+            node = root.get();
+            base = 0;
+            for (int level = shift; level > 0; level -= FIGURE_NODE_BITS) {
+                size_t span = (size_t)1 << level;
+                for (const FigureNodePtr& child : node->children) {
+                    size_t childLive = min(span, offset - base) - child->removed;
+                    if (i < childLive) {
+                        node = child.get();
+                        break;
+                    }
+                    i -= childLive;
+                    base += span;
+                }
+            }
+        } else {
+            i -= treeLive;
+        }
+        size_t k = 0;
+        for (;; k++) {
+            if (!(node->dead >> k & 1) && i-- == 0) break;
+        }
+        return base + k;
+    }
+
+    // Posición de la figura viva del slot s: s menos los huecos anteriores
+    size_t positionOf(size_t s) const {
+        if (!holes()) return s;
+        size_t before = 0;
+        const FigureNode* node = tail.get();
+        if (s < tailOffset()) {
+            node = root.get();
+            for (int level = shift; level > 0; level -= FIGURE_NODE_BITS) {
+                size_t sub = (s >> level) & FIGURE_NODE_MASK;
+                for (size_t j = 0; j < sub; j++) before += node->children[j]->removed;
+                node = node->children[sub].get();
+            }
+        } else if (root) {
+            before = root->removed;
+        }
+        unsigned below = (unsigned)(((unsigned long long)1 << (s & FIGURE_NODE_MASK)) - 1);
+        return s - before - __builtin_popcount(node->dead & below);
+    }
+
+    void clear() {
+        root.reset();
+        tail.reset();
+        slots = 0;
+        shift = FIGURE_NODE_BITS;
+    }
+
+    void swap(FigureList& other) {
+        root.swap(other.root);
+        tail.swap(other.tail);
+        std::swap(slots, other.slots);
+        std::swap(shift, other.shift);
+    }
+
+    void push_back(Figure figure) {
+        if (slots - tailOffset() < FIGURE_NODE_SIZE || !tail) {
+            if (!tail) tail = make_shared<FigureNode>();
+            tail = editable(tail);
+            tail->figures.push_back(move(figure));
+            slots++;
+            return;
+        }
+
+        // Cola llena: pasa al árbol y se empieza una nueva
+        if (!root) {
+            root = make_shared<FigureNode>();
+        }
+        if ((slots >> FIGURE_NODE_BITS) > ((size_t)1 << shift)) {
+            FigureNodePtr newRoot = make_shared<FigureNode>();
+            newRoot->children.push_back(root);
+            newRoot->children.push_back(newPath(shift, tail));
+            newRoot->removed = root->removed + tail->removed;
+            root = newRoot;
+            shift += FIGURE_NODE_BITS;
+        } else {
+            root = pushTail(shift, root, tail);
+        }
+        tail = make_shared<FigureNode>();
+        tail->figures.reserve(FIGURE_NODE_SIZE);
+        tail->figures.push_back(move(figure));
+        slots++;
+    }
+
+    // Quita la última figura y los huecos que la siguen
+    void pop_back() {
+        if (empty()) return;
+        while (!live(slots - 1)) popSlot();
+        popSlot();
+    }
+
+    // Borrar en medio copia solo el camino hasta la hoja: O(log n)
+    void erase(size_t i) {
+        size_t s = slotOf(i);
+        if (s >= tailOffset()) tail = bury(0, tail, s);
+        else root = bury(shift, root, s);
+    }
+
+private:
+    size_t tailOffset() const {
+        return slots < FIGURE_NODE_SIZE ? 0 : ((slots - 1) >> FIGURE_NODE_BITS) << FIGURE_NODE_BITS;
+    }
+
+    size_t holes() const {
+        return (root ? root->removed : 0) + (tail ? tail->removed : 0);
+    }
+
+    const FigureNodePtr& leafNode(size_t i) const {
+        if (i >= tailOffset()) return tail;
+        const FigureNodePtr* node = &root;
+        for (int level = shift; level > 0; level -= FIGURE_NODE_BITS)
+            node = &(*node)->children[(i >> level) & FIGURE_NODE_MASK];
+        return *node;
+    }
+
+    // Copia el nodo solo si alguien más lo comparte. use_count() es una lectura relajada:
+    // si otro hilo acaba de soltar su instantánea, la valla de adquisición (junto con la
+    // liberación del decremento del contador) ordena sus lecturas del nodo antes de que
+    // este hilo lo modifique.
+    static FigureNodePtr editable(const FigureNodePtr& node) {
+        if (node.use_count() != 1) return make_shared<FigureNode>(*node);
+        atomic_thread_fence(memory_order_acquire);
+        return node;
+    }
+
+    static FigureNodePtr newPath(int level, const FigureNodePtr& node) {
+        if (level == 0) return node;
+        FigureNodePtr path = make_shared<FigureNode>();
+        path->children.push_back(newPath(level - FIGURE_NODE_BITS, node));
+        path->removed = node->removed;
+        return path;
+    }
+
+    FigureNodePtr pushTail(int level, const FigureNodePtr& parent, const FigureNodePtr& leaf) {
+        FigureNodePtr node = editable(parent);
+        node->removed += leaf->removed;
+        size_t sub = ((slots - 1) >> level) & FIGURE_NODE_MASK;
+        if (level == FIGURE_NODE_BITS) {
+            node->children.push_back(leaf);
+        } else if (sub < node->children.size()) {
+            node->children[sub] = pushTail(level - FIGURE_NODE_BITS, node->children[sub], leaf);
+        } else {
+            node->children.push_back(newPath(level - FIGURE_NODE_BITS, leaf));
+        }
+        return node;
+    }
+
+    // Como en pushTail, el padre se vuelve editable antes de bajar: un hijo con un
+    // solo dueño puede seguir compartido a través de un padre compartido
+    FigureNodePtr popTail(int level, const FigureNodePtr& parent, size_t leafRemoved) {
+        size_t sub = ((slots - 2) >> level) & FIGURE_NODE_MASK;
+        if (level == FIGURE_NODE_BITS && sub == 0) return nullptr;
+
+        FigureNodePtr node = editable(parent);
+        node->removed -= leafRemoved;
+        if (level > FIGURE_NODE_BITS) {
+            FigureNodePtr child = popTail(level - FIGURE_NODE_BITS, node->children[sub], leafRemoved);
+            if (!child && sub == 0) return nullptr;
+            if (child) node->children[sub] = child;
+            else node->children.pop_back();
+        } else {
+            node->children.pop_back();
+        }
+        return node;
+    }
+
+    // Quita el último slot, sea figura o hueco
+    void popSlot() {
+        if (slots == 1) {
+            clear();
+            return;
+        }
+        if (slots - tailOffset() > 1) {
+            tail = editable(tail);
+            unsigned bit = 1u << ((slots - 1) & FIGURE_NODE_MASK);
+            if (tail->dead & bit) {
+                tail->dead &= ~bit;
+                tail->removed--;
+            }
+            tail->figures.pop_back();
+            slots--;
+            return;
+        }
+
+        // La cola queda vacía: la última hoja del árbol pasa a ser la cola
+        tail = leafNode(slots - 2);
+        root = popTail(shift, root, tail->removed);
+        if (root && shift > FIGURE_NODE_BITS && root->children.size() == 1) {
+            root = root->children[0];
+            shift -= FIGURE_NODE_BITS;
+        }
+        slots--;
+    }
+
+    // Convierte el slot s en hueco copiando los nodos compartidos del camino
+    static FigureNodePtr bury(int level, const FigureNodePtr& parent, size_t s) {
+        FigureNodePtr node = editable(parent);
+        node->removed++;
+        if (level == 0) {
+            node->dead |= 1u << (s & FIGURE_NODE_MASK);
+            node->figures[s & FIGURE_NODE_MASK] = Figure();
+        } else {
+            size_t sub = (s >> level) & FIGURE_NODE_MASK;
+            node->children[sub] = bury(level - FIGURE_NODE_BITS, node->children[sub], s);
+        }
+        return node;
+    }
+
+    FigureNodePtr root, tail;
+    size_t slots = 0;
+    int shift = FIGURE_NODE_BITS;
+};
+
+// Contadores de rendimiento de la ventana. Se actualizan en cada display() y en cada
+// exportación PNG; se pueden consultar desde el código (p. ej. pruebas automáticas).
+const int FIGURE_TYPES = 13;
+const int POLYLINE_TYPE = 5;
+const int BEZIER_TYPE = 6;
+const int POLYGON_EVEN_ODD_TYPE = 7;
+const int POLYGON_NONZERO_TYPE = 8;
+const int FLOOD_FILL_TYPE = 9;
+const int ROTATED_ELLIPSE_TYPE = 10;
+const int CIRCLE_ARC_TYPE = 11;
+const int ELLIPSE_ARC_TYPE = 12;
+
+bool isPolygonType(int type) {
+    return type == POLYGON_EVEN_ODD_TYPE || type == POLYGON_NONZERO_TYPE;
+}
+
+struct PerfCounters {
+    long long frames = 0;
+    double frameMs = 0;                   // tiempo de CPU del último display()
+    bool sceneCached = false;             // el último frame reutilizó la escena en caché
+    double sceneMs = 0;                   // última rasterización completa de la escena
+    double rasterMs[FIGURE_TYPES] = {};   // por tipo de figura en esa rasterización
+    long long pixels[FIGURE_TYPES] = {};  // píxeles emitidos por tipo de figura
+    long long glCalls = 0;                // llamadas a OpenGL del último frame, contadas al emitirlas
+    long long redisplayRequests = 0;      // peticiones de redibujado (se agrupan en frames)
+    int figureCount = 0;
+    int culledFigures = 0;                // fuera de la vista en la última rasterización
+    int pointFigures = 0;                 // reducidas a un punto por ser menores de un píxel
+    long long repeatedPixels = 0;         // repetidos que los trazos evitaron en esa rasterización
+    double exportReadMs = 0, exportEncodeMs = 0, exportWriteMs = 0, exportTotalMs = 0;
+};
+
+// Framebuffer en memoria para renderizar sin OpenGL (exportación por lotes)
+struct Framebuffer {
+    int width = 0, height = 0;
+    int originX = 0, originY = 0;  // columna y fila bajo el origen: (0, 0) queda en (originX, originY - 1)
+    vector<unsigned char> rgb;  // filas de arriba hacia abajo
+    unsigned char color[3] = {0, 0, 0};
+    int thickness = 1;
 };
 
 // Variables globales
@@ -27,10 +433,8 @@ const int WIDTH = 800;
 const int HEIGHT = 600;
 const int GRID_SPACING = 20;
 
-vector<Figure> figures;
-vector<Figure> undoStack;
-Point tempPoints[3];
-int pointCount = 0;
+FigureList figures;
+vector<Point> tempPoints;  // puntos de la figura en construcción
 int currentTool = 0;
 float currentColor[3] = {0.0f, 0.0f, 0.0f};
 int currentThickness = 1;
@@ -38,369 +442,4139 @@ bool showGrid = true;
 bool showAxes = true;
 bool showCoords = false;
 int mouseX = 0, mouseY = 0;
+double viewScale = 1.0;        // píxeles de ventana por unidad del mundo
+double viewX = 0, viewY = 0;   // punto del mundo en el centro de la ventana
+bool panning = false;          // arrastre con el botón central
+int panX = 0, panY = 0;        // última posición del arrastre
+bool sceneDirty = true;   // figuras, cuadrícula o ejes cambiaron desde la última imagen en caché
+unsigned long long sceneVersion = 0;  // se incrementa con cada cambio de la escena
+GLuint sceneTexture = 0;  // copia de la escena rasterizada; la capa superior se dibuja encima
+GLuint glyphBase = 0;     // listas de visualización con los glifos ASCII de GLUT_BITMAP_9_BY_15
+PerfCounters perf;
+bool showPerf = false;
+const char* figureTypeNames[FIGURE_TYPES] = {
+    "Recta directo", "Recta DDA", "Circulo incremental", "Circulo PM", "Elipse PM", "Polilinea", "Bezier",
+    "Poligono par-impar", "Poligono no nulo", "Cubeta", "Elipse girada", "Arco circular", "Arco eliptico"
+};
 
 // Prototipos de funciones
-void drawPixel(int x, int y);
-void drawLineDirect(Point p1, Point p2);
-void drawLineDDA(Point p1, Point p2);
-void drawCircleIncremental(Point center, int radius);
-void drawCircleMidpoint(Point center, int radius);
-void drawEllipseMidpoint(Point center, int rx, int ry);
 void drawGrid();
 void drawAxes();
+template <class Sink> void drawFigure(Sink& sink, const Figure& figure);
 void displayCoordinates();
 
-// Implementación de algoritmos
-void drawPixel(int x, int y) {
-    glPointSize(currentThickness);
-    glBegin(GL_POINTS);
-    glVertex2i(x, y);
-    glEnd();
+// Vista sobre un lienzo sin límites: la ventana muestra el mundo escalado por viewScale
+// alrededor de (viewX, viewY). Las figuras se guardan en coordenadas del mundo y se
+// rasterizan ya proyectadas en píxeles de ventana, con el grosor siempre en píxeles.
+const double MIN_VIEW_SCALE = 1.0 / 4096;
+const double MAX_VIEW_SCALE = 4096;
+const double VIEW_LIMIT = 1e9;           // |coordenada del mundo| máxima alcanzable
+const int CLIP_GUARD = WIDTH + HEIGHT;   // fuera de esta banda se recorta antes de rasterizar
+const double ZOOM_STEP = 1.25;           // factor por paso de rueda o tecla
+const int PAN_STEP = 50;                 // píxeles por pulsación de flecha
+const int LOD_CULLED = 0;   // fuera de la ventana: no se dibuja
+const int LOD_POINT = 1;    // menor que un píxel: un solo punto
+const int LOD_FULL = 2;     // rasterizada con su algoritmo (recortada si es enorme)
+
+double projectX(double x) { return (x - viewX) * viewScale; }
+double projectY(double y) { return (y - viewY) * viewScale; }
+
+double clampWorld(double v) {
+    return min(max(v, -VIEW_LIMIT), VIEW_LIMIT);
+}
+
+// Píxel de ventana (origen en el centro, y hacia arriba) a coordenadas del mundo
+Point screenToWorld(int sx, int sy) {
+    return Point((int)lround(clampWorld(viewX + sx / viewScale)),
+                 (int)lround(clampWorld(viewY + sy / viewScale)));
+}
+
+Point worldToScreen(Point p) {
+    double limit = 4.0 * CLIP_GUARD;  // evita desbordes al convertir puntos muy lejanos
+    return Point((int)lround(min(max(projectX(p.x), -limit), limit)),
+                 (int)lround(min(max(projectY(p.y), -limit), limit)));
+}
+
+// Acerca o aleja manteniendo fijo el punto del mundo bajo el píxel (sx, sy)
+void zoomAt(int sx, int sy, double factor) {
+    double scale = min(max(viewScale * factor, MIN_VIEW_SCALE), MAX_VIEW_SCALE);
+    double wx = viewX + sx / viewScale, wy = viewY + sy / viewScale;
+    viewX = clampWorld(wx - sx / scale);
+    viewY = clampWorld(wy - sy / scale);
+    viewScale = scale;
+    sceneDirty = true;
+}
+
+void panView(int dx, int dy) {
+    viewX = clampWorld(viewX - dx / viewScale);
+    viewY = clampWorld(viewY - dy / viewScale);
+    sceneDirty = true;
+}
+
+void resetView() {
+    viewScale = 1.0;
+    viewX = viewY = 0;
+    sceneDirty = true;
+}
+
+// Implementación de algoritmos
+// Destinos de píxeles. Cada rasterizador se instancia para cada destino, así plot()
+// queda en línea dentro del bucle, sin ramas por píxel ni lecturas de globales.
+// plotPoints() recibe lotes de pares x, y ya expandidos (círculos y elipses) y
+// plotStencil() una plantilla de desplazamientos trasladada al centro de la figura.
+
+// Píxeles repetidos que los trazos ya no emiten: con grosor cada uno es un cuadrado
+// entero y con mezcla cambiaría el color. Solo los cuentan los destinos con un miembro
+// overdraw (la ventana y el que arma plantillas); en los demás la suma no se compila.
+struct OverdrawCounters {
+    long long incremental = 0;  // pasos del círculo incremental que caen en el mismo píxel
+    long long midpoint = 0;     // puntos de los ejes y diagonales en círculos y elipses PM
+    long long paths = 0;        // vértices compartidos por tramos de polilíneas y Bézier
+    long long conics = 0;       // elipses giradas, arcos y cónicas recortadas
+
+    long long total() const { return incremental + midpoint + paths + conics; }
+
+    void add(const OverdrawCounters& other) {
+        incremental += other.incremental;
+        midpoint += other.midpoint;
+        paths += other.paths;
+        conics += other.conics;
+    }
+};
+
+OverdrawCounters overdrawTotal;  // todo lo dibujado en la ventana desde el inicio
+
+template <class Sink>
+auto addOverdraw(Sink& sink, long long OverdrawCounters::*kind, long long n, int) -> decltype((void)sink.overdraw) {
+    sink.overdraw.*kind += n;
+}
+template <class Sink>
+void addOverdraw(Sink&, long long OverdrawCounters::*, long long, long) {}
+
+template <class Sink>
+void countOverdraw(Sink& sink, long long OverdrawCounters::*kind, long long n) {
+    addOverdraw(sink, kind, n, 0);
+}
+
+// Píxeles de un círculo o elipse relativos a su centro
+struct StencilRun {
+    int y, x0, x1;  // fila y columnas x0..x1, ambas incluidas
+};
+
+struct Stencil {
+    vector<int> xy;           // trazo de 1 píxel en el orden del algoritmo (pares x, y)
+    vector<StencilRun> runs;  // píxeles cubiertos con el grosor, en tramos por fila
+    int repeats = 0;          // repetidos que el algoritmo no emitió; cuentan en cada uso
+    int count() const { return (int)(xy.size() / 2); }
+};
+
+// OpenGL: los píxeles de la figura se acumulan en lotes del propio destino y cada lote
+// se envía con un solo glDrawArrays; una figura que no llena el lote es una llamada.
+const int GL_BATCH_POINTS = 4096;
+const int GL_BATCH_SPANS = 1024;
+
+struct GLSink {
+    int thickness;
+    long long pixels = 0;
+    OverdrawCounters overdraw;
+    int pointCount = 0, spanCount = 0;
+    int points[2 * GL_BATCH_POINTS];  // pares x, y
+    int spans[8 * GL_BATCH_SPANS];    // tramos de relleno como cuadriláteros (4 vértices por tramo)
+
+    explicit GLSink(int thickness) : thickness(thickness) {}
+    GLSink(const GLSink&) = delete;
+    GLSink& operator=(const GLSink&) = delete;
+    ~GLSink() {
+        flushPoints();
+        flushSpans();
+    }
+
+    void flushPoints() {
+        if (pointCount == 0) return;
+        glPointSize(thickness);
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glVertexPointer(2, GL_INT, 0, points);
+        glDrawArrays(GL_POINTS, 0, pointCount);
+        glDisableClientState(GL_VERTEX_ARRAY);
+        perf.glCalls += 5;
+        pointCount = 0;
+    }
+    void flushSpans() {
+        if (spanCount == 0) return;
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glVertexPointer(2, GL_INT, 0, spans);
+        glDrawArrays(GL_QUADS, 0, 4 * spanCount);
+        glDisableClientState(GL_VERTEX_ARRAY);
+        perf.glCalls += 4;
+        spanCount = 0;
+    }
+
+    void plot(int x, int y) {
+        if (pointCount == GL_BATCH_POINTS) flushPoints();
+        points[2 * pointCount] = x;
+        points[2 * pointCount + 1] = y;
+        pointCount++;
+        pixels++;
+    }
+    void plotPoints(const int* xy, int n) {
+        pixels += n;
+        while (n > 0) {
+            if (pointCount == GL_BATCH_POINTS) flushPoints();
+            int k = min(n, GL_BATCH_POINTS - pointCount);
+            memcpy(points + 2 * pointCount, xy, sizeof(int) * 2 * k);
+            pointCount += k;
+            xy += 2 * k;
+            n -= k;
+        }
+    }
+    // El grosor lo aplica glPointSize: la plantilla es el trazo de 1 píxel
+    int stencilThickness() const { return 1; }
+    void plotStencil(Point center, const Stencil& stencil) {
+        const int* xy = stencil.xy.data();
+        int n = stencil.count();
+        pixels += n;
+        overdraw.midpoint += stencil.repeats;
+        while (n > 0) {
+            if (pointCount == GL_BATCH_POINTS) flushPoints();
+            int k = min(n, GL_BATCH_POINTS - pointCount);
+            int* dst = points + 2 * pointCount;
+            for (int i = 0; i < 2 * k; i += 2) {
+                dst[i] = center.x + xy[i];
+                dst[i + 1] = center.y + xy[i + 1];
+            }
+            pointCount += k;
+            xy += 2 * k;
+            n -= k;
+        }
+    }
+    // Tramo de relleno x0..x1 en la fila y: el píxel (x, y) es el cuadrado [x, x+1] x [y, y+1]
+    // de la ventana, el mismo que cubre un punto de 1 px, y el relleno no depende del grosor
+    void plotSpan(int y, int x0, int x1) {
+        if (spanCount == GL_BATCH_SPANS) flushSpans();
+        int* quad = spans + 8 * spanCount++;
+        quad[0] = x0;     quad[1] = y;
+        quad[2] = x1 + 1; quad[3] = y;
+        quad[4] = x1 + 1; quad[5] = y + 1;
+        quad[6] = x0;     quad[7] = y + 1;
+        pixels += x1 - x0 + 1;
+    }
+};
+
+// Rellena count píxeles RGB seguidos con un color. Con SSE2 se escriben 16 píxeles por
+// vuelta: el patrón RGB se repite cada 48 bytes, justo tres registros de 16.
+void fillRow(unsigned char* px, int count, const unsigned char color[3]) {
+#ifdef __SSE2__
+    if (count >= 16) {
+        alignas(16) unsigned char pattern[48];
+        for (int i = 0; i < 48; i++) pattern[i] = color[i % 3];
+        __m128i a = _mm_load_si128((const __m128i*)pattern);
+        __m128i b = _mm_load_si128((const __m128i*)(pattern + 16));
+        __m128i c = _mm_load_si128((const __m128i*)(pattern + 32));
+        for (; count >= 16; count -= 16, px += 48) {
+            _mm_storeu_si128((__m128i*)px, a);
+            _mm_storeu_si128((__m128i*)(px + 16), b);
+            _mm_storeu_si128((__m128i*)(px + 32), c);
+        }
+    }
+#endif
+    for (; count > 0; count--, px += 3) {
+        px[0] = color[0];
+        px[1] = color[1];
+        px[2] = color[2];
+    }
+}
+
+// Rasterizado en memoria: emula glPointSize con un cuadrado de thickness píxeles
+// colocado igual que en OpenGL (para grosor par queda desplazado hacia abajo-izquierda).
+// Con Thin el trazo es de 1 píxel y cada plot escribe un único píxel.
+template <bool Thin>
+struct FramebufferSink {
+    unsigned char* rgb;
+    int width, height, originX, originY, thickness;
+    unsigned char color[3];
+
+    explicit FramebufferSink(Framebuffer& fb)
+        : rgb(fb.rgb.data()), width(fb.width), height(fb.height), originX(fb.originX), originY(fb.originY),
+          thickness(fb.thickness) {
+        memcpy(color, fb.color, 3);
+    }
+
+    void plot(int x, int y) {
+        if (Thin) plotPixel(x, y);
+        else plotSquare(x, y);
+    }
+
+    void plotPixel(int x, int y) {
+        unsigned col = x + originX, row = originY - 1 - y;
+        if (col < (unsigned)width && row < (unsigned)height) {
+            unsigned char* px = rgb + 3 * (row * width + col);
+            px[0] = color[0];
+            px[1] = color[1];
+            px[2] = color[2];
+        }
+    }
+
+    void plotPoints(const int* xy, int n) {
+        for (int i = 0; i < n; i++) plot(xy[2 * i], xy[2 * i + 1]);
+    }
+
+    // La plantilla ya incluye el grosor: cada píxel cubierto se escribe una vez, por tramos
+    int stencilThickness() const { return Thin ? 1 : thickness; }
+    void plotStencil(Point center, const Stencil& stencil) {
+        for (const StencilRun& run : stencil.runs) {
+            unsigned row = originY - 1 - (center.y + run.y);
+            if (row >= (unsigned)height) continue;
+            int col0 = max(center.x + run.x0 + originX, 0);
+            int col1 = min(center.x + run.x1 + originX, width - 1);
+            unsigned char* px = rgb + 3 * (row * width + col0);
+            for (int col = col0; col <= col1; col++, px += 3) {
+                px[0] = color[0];
+                px[1] = color[1];
+                px[2] = color[2];
+            }
+        }
+    }
+
+    // Tramo de relleno: una fila contigua, sin el cuadrado del grosor
+    void plotSpan(int y, int x0, int x1) {
+        unsigned row = originY - 1 - y;
+        if (row >= (unsigned)height) return;
+        int col0 = max(x0 + originX, 0), col1 = min(x1 + originX, width - 1);
+        if (col0 <= col1) fillRow(rgb + 3 * ((size_t)row * width + col0), col1 - col0 + 1, color);
+    }
+
+    // Fuera de línea: el bucle del cuadrado repetido en cada octante del punto medio
+    // agranda el código del rasterizador y lo hace más lento que la llamada
+    __attribute__((noinline)) void plotSquare(int x, int y) {
+        int t = thickness;
+        int left = x + originX - t/2;
+        int top = originY - y - (t - t/2);
+        int x0 = max(left, 0), x1 = min(left + t, width);
+        int y0 = max(top, 0), y1 = min(top + t, height);
+
+        for (int row = y0; row < y1; row++) {
+            unsigned char* px = rgb + 3 * (row * width + x0);
+            for (int col = x0; col < x1; col++, px += 3) {
+                px[0] = color[0];
+                px[1] = color[1];
+                px[2] = color[2];
+            }
+        }
+    }
+};
+
+// Guarda los píxeles en orden (exportación SVG de píxeles exactos)
+struct CaptureSink {
+    vector<Point>& pixels;
+    explicit CaptureSink(vector<Point>& out) : pixels(out) {}
+    void plot(int x, int y) { pixels.push_back(Point(x, y)); }
+    void plotPoints(const int* xy, int n) {
+        for (int i = 0; i < n; i++) pixels.push_back(Point(xy[2 * i], xy[2 * i + 1]));
+    }
+    int stencilThickness() const { return 1; }
+    void plotStencil(Point center, const Stencil& stencil) {
+        for (size_t i = 0; i < stencil.xy.size(); i += 2)
+            pixels.push_back(Point(center.x + stencil.xy[i], center.y + stencil.xy[i + 1]));
+    }
+    void plotSpan(int y, int x0, int x1) {
+        for (int x = x0; x <= x1; x++) pixels.push_back(Point(x, y));
+    }
+};
+
+// Solo cuenta píxeles, para medir el coste de rasterizado sin dibujar
+struct CountingSink {
+    long long pixels = 0;
+    void plot(int, int) { pixels++; }
+    void plotPoints(const int*, int n) { pixels += n; }
+    int stencilThickness() const { return 1; }
+    void plotStencil(Point, const Stencil& stencil) { pixels += stencil.count(); }
+    void plotSpan(int, int x0, int x1) { pixels += x1 - x0 + 1; }
+};
+
+// Rectas en punto fijo. Dan exactamente los mismos píxeles que las versiones en float,
+// que se siguen usando fuera de ±FIXED_LINE_LIMIT, donde ya no está garantizado:
+// - Directo: la ordenada exacta avanza en 32.32 sin divisiones. El float solo puede
+//   decidir distinto cuando el valor queda a menos de 2^-8 de un .5 (su error con
+//   coordenadas de hasta 2048 es < 2^-10), y esos píxeles se evalúan con la fórmula float.
+// - DDA: el acumulador float se emula en 24.40 redondeando cada suma a 24 bits de
+//   mantisa (al par), como hace la suma en float, así el desvío acumulado es idéntico.
+const int FIXED_LINE_LIMIT = 2048;
+const unsigned int NEAR_TIE = 1u << 24;  // 2^-8 en la parte fraccionaria 0.32
+
+bool fitsFixedLine(Point p1, Point p2) {
+    return abs(p1.x) <= FIXED_LINE_LIMIT && abs(p1.y) <= FIXED_LINE_LIMIT &&
+           abs(p2.x) <= FIXED_LINE_LIMIT && abs(p2.y) <= FIXED_LINE_LIMIT;
+}
+
+// Redondea un valor 24.40 al float más cercano (empates al par)
+long long roundToFloat40(long long v) {
+    unsigned long long mag = v < 0 ? -v : v;
+    if (mag < (1ULL << 24)) return v;  // menos de 24 bits significativos: ya es exacto
+    int shift = 63 - __builtin_clzll(mag) - 23;
+    unsigned long long unit = 1ULL << shift, rem = mag & (unit - 1);
+    mag -= rem;
+    if (rem > unit / 2 || (rem == unit / 2 && (mag & unit))) mag += unit;
+    return v < 0 ? -(long long)mag : (long long)mag;
+}
+
+// round() de un valor 24.40: al entero más cercano, empates lejos de cero
+int roundFixed40(long long v) {
+    const long long half = 1LL << 39;
+    return v < 0 ? -(int)((-v + half) >> 40) : (int)((v + half) >> 40);
+}
+
+// Recta directa con |pendiente| <= 1 (pendiente y ordenada float solo para casi empates)
+template <class Sink>
+void drawLineDirectShallowFixed(Sink& sink, Point p1, Point p2, float m, float b) {
+    Point s = p1.x < p2.x ? p1 : p2, e = p1.x < p2.x ? p2 : p1;
+    long long y = ((long long)s.y << 32) + (1LL << 31);  // +0.5: la parte entera es el redondeo
+    long long step = ((long long)(e.y - s.y) << 32) / (e.x - s.x);
+    for (int x = s.x; x <= e.x; x++, y += step) {
+        if ((unsigned int)y + NEAR_TIE < 2 * NEAR_TIE) sink.plot(x, round(m * x + b));
+        else sink.plot(x, (int)(y >> 32));
+    }
+}
+
+template <class Sink>
+void drawLineDirectSteepFixed(Sink& sink, Point p1, Point p2, float m, float b) {
+    Point s = p1.y < p2.y ? p1 : p2, e = p1.y < p2.y ? p2 : p1;
+    long long x = ((long long)s.x << 32) + (1LL << 31);
+    long long step = ((long long)(e.x - s.x) << 32) / (e.y - s.y);
+    for (int y = s.y; y <= e.y; y++, x += step) {
+        if ((unsigned int)x + NEAR_TIE < 2 * NEAR_TIE) sink.plot(round((y - b) / m), y);
+        else sink.plot((int)(x >> 32), y);
+    }
+}
+
+// El eje mayor avanza de 1 en 1 (exacto también en float); solo el menor se emula
+template <class Sink>
+void drawLineDDAFixed(Sink& sink, Point p1, Point p2, int steps) {
+    int dx = p2.x - p1.x, dy = p2.y - p1.y;
+    if (abs(dx) == steps) {
+        float yInc = dy / (float)steps;
+        long long yStep = (long long)ldexp(yInc, 40), y = (long long)p1.y << 40;
+        int xStep = dx > 0 ? 1 : -1;
+        for (int i = 0, x = p1.x; i <= steps; i++, x += xStep) {
+            sink.plot(x, roundFixed40(y));
+            y = roundToFloat40(y + yStep);
+        }
+    } else {
+        float xInc = dx / (float)steps;
+        long long xStep = (long long)ldexp(xInc, 40), x = (long long)p1.x << 40;
+        int yStep = dy > 0 ? 1 : -1;
+        for (int i = 0, y = p1.y; i <= steps; i++, y += yStep) {
+            sink.plot(roundFixed40(x), y);
+            x = roundToFloat40(x + xStep);
+        }
+    }
+}
+
+// Versiones en float: fuera de ±FIXED_LINE_LIMIT y como referencia de --bench-lines
+template <class Sink>
+void drawLineDirectFloat(Sink& sink, Point p1, Point p2, float m, float b) {
+    if (abs(m) <= 1.0f) {
+        int x1 = min(p1.x, p2.x);
+        int x2 = max(p1.x, p2.x);
+        for (int x = x1; x <= x2; x++) {
+            int y = round(m * x + b);
+            sink.plot(x, y);
+        }
+    } else {
+        int y1 = min(p1.y, p2.y);
+        int y2 = max(p1.y, p2.y);
+        for (int y = y1; y <= y2; y++) {
+            int x = round((y - b) / m);
+            sink.plot(x, y);
+        }
+    }
+}
+
+template <class Sink>
+void drawLineDDAFloat(Sink& sink, Point p1, Point p2, int steps) {
+    int dx = p2.x - p1.x;
+    int dy = p2.y - p1.y;
+    float xInc = dx / (float)steps;
+    float yInc = dy / (float)steps;
+
+    float x = p1.x;
+    float y = p1.y;
+
+    for (int i = 0; i <= steps; i++) {
+        sink.plot(round(x), round(y));
+        x += xInc;
+        y += yInc;
+    }
+}
+
+template <class Sink>
+void drawLineDirect(Sink& sink, Point p1, Point p2) {
+    TRACE_SCOPE("drawLineDirect");
+    if (p1.x == p2.x) { // Línea vertical
+        int y1 = min(p1.y, p2.y);
+        int y2 = max(p1.y, p2.y);
+        for (int y = y1; y <= y2; y++) {
+            sink.plot(p1.x, y);
+        }
+        return;
+    }
+
+    float m = float(p2.y - p1.y) / (p2.x - p1.x);
+    float b = p1.y - m * p1.x;
+
+    if (!fitsFixedLine(p1, p2)) drawLineDirectFloat(sink, p1, p2, m, b);
+    else if (abs(m) <= 1.0f) drawLineDirectShallowFixed(sink, p1, p2, m, b);
+    else drawLineDirectSteepFixed(sink, p1, p2, m, b);
+}
+
+template <class Sink>
+void drawLineDDA(Sink& sink, Point p1, Point p2) {
+    TRACE_SCOPE("drawLineDDA");
+    int dx = p2.x - p1.x;
+    int dy = p2.y - p1.y;
+    int steps = max(abs(dx), abs(dy));
+
+    if (steps == 0) {
+        sink.plot(p1.x, p1.y);
+        return;
+    }
+    if (fitsFixedLine(p1, p2)) drawLineDDAFixed(sink, p1, p2, steps);
+    else drawLineDDAFloat(sink, p1, p2, steps);
+}
+
+// Los pasos de 1/radio en el ángulo caen a menudo en el mismo píxel que el anterior, y
+// al cerrar la vuelta en los primeros; ambos se saltan. Con el truncado cada coordenada
+// es monótona dentro de un cuadrante, así que no hay otras repeticiones.
+const int CIRCLE_INCREMENTAL_START = 4;  // primeros píxeles que pueden repetirse al cerrar
+
+template <class Sink>
+void drawCircleIncremental(Sink& sink, Point center, int radius) {
+    TRACE_SCOPE("drawCircleIncremental");
+    float angle = 0;
+    float angleIncrement = 1.0f / radius;
+    Point start[CIRCLE_INCREMENTAL_START];
+    int starts = 0;
+    int lastX = INT_MIN, lastY = INT_MIN;
+
+    while (angle < 2 * M_PI) {
+        int x = center.x + radius * cos(angle);
+        int y = center.y + radius * sin(angle);
+        angle += angleIncrement;
+        if (x == lastX && y == lastY) {
+            countOverdraw(sink, &OverdrawCounters::incremental, 1);
+            continue;
+        }
+        lastX = x;
+        lastY = y;
+        if (starts < CIRCLE_INCREMENTAL_START) {
+            start[starts++] = Point(x, y);
+        } else if (angle > M_PI) {
+            bool repeated = false;
+            for (int i = 0; i < starts && !repeated; i++) repeated = start[i].x == x && start[i].y == y;
+            if (repeated) {
+                countOverdraw(sink, &OverdrawCounters::incremental, 1);
+                continue;
+            }
+        }
+        sink.plot(x, y);
+    }
+}
+
+// Expansión por simetría: los algoritmos de punto medio calculan primero un lote de
+// semillas (x, y) del primer octante (cuadrante en la elipse) y luego cada semilla se
+// convierte en sus 8 (o 4) puntos simétricos con sumas, cambios de signo y barajados
+// SSE2, escritos directamente en el búfer de píxeles en el mismo orden de siempre.
+const int OCTANT_BATCH = 64;
+
+int expandCircleOctants(Point center, const int* seeds, int n, int* out) {
+#ifdef __SSE2__
+    const __m128i c = _mm_set_epi32(center.y, center.x, center.y, center.x);
+    const __m128i negX = _mm_set_epi32(0, -1, 0, 0);     // (a, b, -a, b)
+    const __m128i negXY = _mm_set_epi32(-1, -1, -1, 0);  // (a, -b, -a, -b)
+    for (int i = 0; i < n; i++) {
+        __m128i v = _mm_loadl_epi64((const __m128i*)(seeds + 2 * i));
+        v = _mm_unpacklo_epi64(v, v);                           // (x, y, x, y)
+        __m128i w = _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 0, 1));  // (y, x, y, x)
+        __m128i* dst = (__m128i*)(out + 16 * i);
+        _mm_storeu_si128(dst, _mm_add_epi32(c, _mm_sub_epi32(_mm_xor_si128(v, negX), negX)));
+        _mm_storeu_si128(dst + 1, _mm_add_epi32(c, _mm_sub_epi32(_mm_xor_si128(v, negXY), negXY)));
+        _mm_storeu_si128(dst + 2, _mm_add_epi32(c, _mm_sub_epi32(_mm_xor_si128(w, negX), negX)));
+        _mm_storeu_si128(dst + 3, _mm_add_epi32(c, _mm_sub_epi32(_mm_xor_si128(w, negXY), negXY)));
+    }
+#else
+    for (int i = 0; i < n; i++) {
+        int x = seeds[2 * i], y = seeds[2 * i + 1];
+        const int pts[16] = {x, y, -x, y, x, -y, -x, -y, y, x, -y, x, y, -x, -y, -x};
+        for (int k = 0; k < 16; k += 2) {
+            out[16 * i + k] = center.x + pts[k];
+            out[16 * i + k + 1] = center.y + pts[k + 1];
+        }
+    }
+#endif
+    return 8 * n;
+}
+
+int expandEllipseQuadrants(Point center, const int* seeds, int n, int* out) {
+#ifdef __SSE2__
+    const __m128i c = _mm_set_epi32(center.y, center.x, center.y, center.x);
+    const __m128i negX = _mm_set_epi32(0, -1, 0, 0);
+    const __m128i negXY = _mm_set_epi32(-1, -1, -1, 0);
+    for (int i = 0; i < n; i++) {
+        __m128i v = _mm_loadl_epi64((const __m128i*)(seeds + 2 * i));
+        v = _mm_unpacklo_epi64(v, v);
+        __m128i* dst = (__m128i*)(out + 8 * i);
+        _mm_storeu_si128(dst, _mm_add_epi32(c, _mm_sub_epi32(_mm_xor_si128(v, negX), negX)));
+        _mm_storeu_si128(dst + 1, _mm_add_epi32(c, _mm_sub_epi32(_mm_xor_si128(v, negXY), negXY)));
+    }
+#else
+    for (int i = 0; i < n; i++) {
+        int x = seeds[2 * i], y = seeds[2 * i + 1];
+        const int pts[8] = {x, y, -x, y, x, -y, -x, -y};
+        for (int k = 0; k < 8; k += 2) {
+            out[8 * i + k] = center.x + pts[k];
+            out[8 * i + k + 1] = center.y + pts[k + 1];
+        }
+    }
+#endif
+    return 4 * n;
+}
+
+template <class Sink>
+void drawCircleMidpoint(Sink& sink, Point center, int radius) {
+    TRACE_SCOPE("drawCircleMidpoint");
+    alignas(16) int seeds[2 * OCTANT_BATCH];
+    alignas(16) int pixels[16 * OCTANT_BATCH];
+    int n = 0;
+
+    int x = 0;
+    int y = radius;
+    int d = 1 - radius;
+
+    while (x <= y) {
+        if (x == 0 || x == y) {
+            // En los ejes (x = 0) y en la diagonal (x = y) los 8 simétricos son solo 4
+            // distintos (con radio 0, uno)
+            int points[8], unique = 0;
+            auto add = [&](int px, int py) {
+                points[2 * unique] = center.x + px;
+                points[2 * unique + 1] = center.y + py;
+                unique++;
+            };
+            if (radius == 0) {
+                add(0, 0);
+            } else if (x == 0) {
+                add(0, y); add(0, -y); add(y, 0); add(-y, 0);
+            } else {
+                add(x, x); add(-x, x); add(x, -x); add(-x, -x);
+            }
+            sink.plotPoints(points, unique);
+            countOverdraw(sink, &OverdrawCounters::midpoint, 8 - unique);
+        } else {
+            // Semilla del primer octante; los 8 octantes se dibujan al expandir el lote
+            seeds[2 * n] = x;
+            seeds[2 * n + 1] = y;
+            if (++n == OCTANT_BATCH) {
+                sink.plotPoints(pixels, expandCircleOctants(center, seeds, n, pixels));
+                n = 0;
+            }
+        }
+
+        if (d < 0) {
+            d += 2 * x + 3;
+        } else {
+            d += 2 * (x - y) + 5;
+            y--;
+        }
+        x++;
+    }
+    if (n > 0) sink.plotPoints(pixels, expandCircleOctants(center, seeds, n, pixels));
+}
+
+// Elipse de punto medio. Las decisiones crecen como rx²·ry: en int son exactas hasta
+// radios de unos 800 píxeles y por encima se usa la misma recurrencia en 64 bits, exacta
+// hasta ELLIPSE_WIDE_LIMIT. Los valores iniciales de cada región se calculan siempre en
+// 64 bits sin coma flotante, redondeados como round() (la mitad lejos del cero), así
+// las dos versiones dan los mismos píxeles.
+const int ELLIPSE_WIDE_LIMIT = 1 << 20;
+
+bool ellipseFitsInt(int rx, int ry) {
+    long long rx2 = (long long)rx * rx, ry2 = (long long)ry * ry;
+    return 2 * rx2 * ry + 2 * ry2 * rx + rx2 + ry2 < INT_MAX;
+}
+
+// round(q / 4) con la mitad lejos del cero
+long long roundQuarters(long long q) {
+    return q >= 0 ? (q + 2) / 4 : -((-q + 2) / 4);
+}
+
+template <class Int, class Sink>
+void drawEllipseMidpointKernel(Sink& sink, Point center, int rx, int ry) {
+    alignas(16) int seeds[2 * OCTANT_BATCH];
+    alignas(16) int pixels[8 * OCTANT_BATCH];
+    int n = 0;
+    auto addSeed = [&](int x, int y) {
+        if (x == 0 || y == 0) {
+            // En los ejes los 4 simétricos son solo 2 distintos
+            const int points[4] = {center.x + x, center.y + y, center.x - x, center.y - y};
+            sink.plotPoints(points, 2);
+            countOverdraw(sink, &OverdrawCounters::midpoint, 2);
+            return;
+        }
+        seeds[2 * n] = x;
+        seeds[2 * n + 1] = y;
+        if (++n == OCTANT_BATCH) {
+            sink.plotPoints(pixels, expandEllipseQuadrants(center, seeds, n, pixels));
+            n = 0;
+        }
+    };
+
+    int x = 0;
+    int y = ry;
+    Int rx2 = (Int)rx * rx;
+    Int ry2 = (Int)ry * ry;
+    Int twoRx2 = 2 * rx2;
+    Int twoRy2 = 2 * ry2;
+
+    // Región 1: p = round(ry² - rx²·ry + rx²/4), en cuartos para que sea exacto
+    long long quarters = 4 * (long long)ry2 - 4 * (long long)rx2 * ry + (long long)rx2;
+    long long p1 = roundQuarters(quarters);
+    long long error4 = 4 * p1 - quarters;  // 4·(p - valor exacto), entre -2 y 2
+    Int p = (Int)p1;
+    Int px = 0;
+    Int py = twoRx2 * y;
+
+    while (px < py) {
+        addSeed(x, y);
+
+        x++;
+        px += twoRy2;
+
+        if (p < 0) {
+            p += ry2 + px;
+        } else {
+            y--;
+            py -= twoRx2;
+            p += ry2 + px - py;
+        }
+    }
+
+    // Región 2: p = round(ry²·(x + 1/2)² + rx²·(y - 1)² - rx²·ry²). Se obtiene de la
+    // decisión de la región 1, que vale exactamente F(x + 1, y - 1/2) - error4/4, sumando
+    // F(x + 1/2, y - 1) - F(x + 1, y - 1/2) = -ry²·x - rx²·y + 3(rx² - ry²)/4; así no
+    // aparece el término rx²·ry², que no cabe ni en 64 bits con radios de 1e6.
+    long long fraction4 = 3 * ((long long)rx2 - (long long)ry2) - error4;
+    long long whole = fraction4 >= 0 ? fraction4 / 4 : -((-fraction4 + 3) / 4);  // suelo
+    fraction4 -= 4 * whole;  // 0..3
+    long long n2 = (long long)p - (long long)ry2 * x - (long long)rx2 * y + whole;
+    p = (Int)(fraction4 < 2 ? n2 : fraction4 > 2 ? n2 + 1 : n2 >= 0 ? n2 + 1 : n2);
+
+    while (y >= 0) {
+        addSeed(x, y);
+
+        y--;
+        py -= twoRx2;
+
+        if (p > 0) {
+            p += rx2 - py;
+        } else {
+            x++;
+            px += twoRy2;
+            p += rx2 - py + px;
+        }
+    }
+    if (n > 0) sink.plotPoints(pixels, expandEllipseQuadrants(center, seeds, n, pixels));
+}
+
+// Radios de 1 a ELLIPSE_WIDE_LIMIT; la versión en 64 bits solo cuando int desbordaría
+template <class Sink>
+void drawEllipseMidpoint(Sink& sink, Point center, int rx, int ry) {
+    TRACE_SCOPE("drawEllipseMidpoint");
+    if (rx <= 0 || ry <= 0) return;
+    if (ellipseFitsInt(rx, ry)) drawEllipseMidpointKernel<int>(sink, center, rx, ry);
+    else drawEllipseMidpointKernel<long long>(sink, center, rx, ry);
+}
+
+// Caché de plantillas de círculos y elipses de punto medio. Los planos repiten los
+// mismos radios (taladros, redondeos, matrices), así que el bucle de decisión se
+// ejecuta una vez por (algoritmo, rx, ry, grosor) y cada figura es una copia trasladada
+// de la plantilla. Al pasar el límite de memoria se descartan las menos usadas (LRU);
+// con la caché llena, una clave nueva solo entra si se ha usado claramente más que la
+// que saldría, así redibujar muchas figuras distintas en cada frame no la vacía una y
+// otra vez. Cada hilo tiene la suya, sin cerrojos.
+const size_t STENCIL_CACHE_BYTES = 32u << 20;  // límite por hilo
+const size_t STENCIL_MAX_BYTES = 4u << 20;     // las plantillas mayores se dibujan sin caché
+const int STENCIL_MAX_THICKNESS = 255;
+const size_t STENCIL_FREQUENCY_KEYS = 1u << 16;  // claves con usos contados antes de envejecer
+const long long STENCIL_AGE_PERIOD = 1 << 20;    // consultas entre dos envejecimientos
+
+// Destino que guarda los píxeles relativos al centro (0, 0)
+struct StencilBuilder {
+    vector<int>& xy;
+    OverdrawCounters overdraw;
+    void plot(int x, int y) {
+        xy.push_back(x);
+        xy.push_back(y);
+    }
+    void plotPoints(const int* points, int n) { xy.insert(xy.end(), points, points + 2 * n); }
+};
+
+// Rasteriza el trazo en el origen y agrupa en tramos por fila los píxeles que cubre con
+// el grosor dado (cuadrados colocados como en FramebufferSink::plotSquare). Con grosor
+// mayor que 1 solo se guardan los tramos: los demás destinos usan la plantilla de grosor 1.
+Stencil buildStencil(int type, int rx, int ry, int thickness) {
+    Stencil stencil;
+    StencilBuilder builder{stencil.xy};
+    if (type == 3) drawCircleMidpoint(builder, Point(0, 0), rx);
+    else drawEllipseMidpoint(builder, Point(0, 0), rx, ry);
+    stencil.repeats = (int)builder.overdraw.midpoint;
+    if (stencil.xy.empty()) return stencil;
+
+    int minX = stencil.xy[0], maxX = minX, minY = stencil.xy[1], maxY = minY;
+    for (size_t i = 0; i < stencil.xy.size(); i += 2) {
+        minX = min(minX, stencil.xy[i]);
+        maxX = max(maxX, stencil.xy[i]);
+        minY = min(minY, stencil.xy[i + 1]);
+        maxY = max(maxY, stencil.xy[i + 1]);
+    }
+    int lo = -(thickness / 2);
+    int w = maxX - minX + thickness, h = maxY - minY + thickness;
+    vector<unsigned char> covered((size_t)w * h);
+    for (size_t i = 0; i < stencil.xy.size(); i += 2) {
+        unsigned char* cell = covered.data() + (size_t)(stencil.xy[i + 1] - minY) * w + (stencil.xy[i] - minX);
+        for (int dy = 0; dy < thickness; dy++) memset(cell + (size_t)dy * w, 1, thickness);
+    }
+    for (int row = 0; row < h; row++) {
+        const unsigned char* line = covered.data() + (size_t)row * w;
+        for (int col = 0; col < w; col++) {
+            if (!line[col]) continue;
+            int start = col;
+            while (col + 1 < w && line[col + 1]) col++;
+            stencil.runs.push_back({row + minY + lo, start + minX + lo, col + minX + lo});
+        }
+    }
+
+    if (thickness > 1) vector<int>().swap(stencil.xy);
+    else stencil.xy.shrink_to_fit();
+    stencil.runs.shrink_to_fit();
+    return stencil;
+}
+
+struct StencilCache {
+    struct Entry {
+        unsigned long long key;
+        Stencil stencil;
+    };
+    list<Entry> entries;  // la usada más recientemente al principio
+    unordered_map<unsigned long long, list<Entry>::iterator> index;
+    unordered_map<unsigned long long, unsigned> frequency;  // usos recientes, también sin plantilla
+    size_t bytes = 0;
+    long long lookups = 0;
+    long long hits = 0, misses = 0, evictions = 0, bypassed = 0;
+
+    static size_t entryBytes(const Stencil& stencil) {
+        return sizeof(Entry) + 4 * sizeof(void*) + stencil.xy.capacity() * sizeof(int) +
+               stencil.runs.capacity() * sizeof(StencilRun);
+    }
+
+    unsigned frequencyOf(unsigned long long key) const {
+        auto it = frequency.find(key);
+        return it == frequency.end() ? 0 : it->second;
+    }
+
+    // Se reducen a la mitad los usos para que las claves antiguas pesen menos
+    void age() {
+        for (auto it = frequency.begin(); it != frequency.end();) {
+            if ((it->second /= 2) == 0) it = frequency.erase(it);
+            else ++it;
+        }
+    }
+
+    // Devuelve la plantilla, o nullptr si la figura debe dibujarse sin caché
+    Stencil* get(int type, int rx, int ry, int thickness) {
+        // Cota de píxeles del trazo (4 por paso en x + y) por el cuadrado del grosor
+        size_t estimate = 4 * ((size_t)rx + ry + 2) * thickness * thickness * 2 * sizeof(int);
+        if (thickness < 1 || thickness > STENCIL_MAX_THICKNESS || estimate > STENCIL_MAX_BYTES) {
+            bypassed++;
+            return nullptr;
+        }
+        unsigned long long key = (unsigned long long)type << 60 | (unsigned long long)thickness << 52 |
+                                 (unsigned long long)rx << 26 | (unsigned long long)ry;
+        if (frequency.size() >= STENCIL_FREQUENCY_KEYS || ++lookups % STENCIL_AGE_PERIOD == 0) age();
+        unsigned uses = ++frequency[key];
+
+        auto it = index.find(key);
+        if (it != index.end()) {
+            hits++;
+            entries.splice(entries.begin(), entries, it->second);
+            return &it->second->stencil;
+        }
+        misses++;
+        // La primera vez se dibuja directamente; si no cabe sin descartar, solo entra si se ha
+        // usado al menos dos veces más que la menos reciente (entre frames de un mismo
+        // recorrido las dos suelen diferir en uno)
+        if (uses < 2) return nullptr;
+        if (bytes + estimate > STENCIL_CACHE_BYTES && uses < frequencyOf(entries.back().key) + 2) return nullptr;
+
+        entries.push_front(Entry{key, buildStencil(type, rx, ry, thickness)});
+        index[key] = entries.begin();
+        bytes += entryBytes(entries.front().stencil);
+        while (bytes > STENCIL_CACHE_BYTES && entries.size() > 1) {
+            bytes -= entryBytes(entries.back().stencil);
+            index.erase(entries.back().key);
+            entries.pop_back();
+            evictions++;
+        }
+        return &entries.front().stencil;
+    }
+};
+
+thread_local StencilCache stencilCache;
+
+// Círculo (TYPE 3) o elipse (TYPE 4) de punto medio a través de la caché de plantillas
+template <class Sink, int TYPE>
+void drawMidpointStencil(Sink& sink, Point center, int rx, int ry) {
+    if (const Stencil* stencil = stencilCache.get(TYPE, rx, ry, sink.stencilThickness())) {
+        sink.plotStencil(center, *stencil);
+    } else if (TYPE == 3) {
+        drawCircleMidpoint(sink, center, rx);
+    } else {
+        drawEllipseMidpoint(sink, center, rx, ry);
+    }
+}
+
+// Aplanado de curvas Bézier cúbicas por diferencias hacia adelante adaptativas. El
+// paso en t se reduce a la mitad mientras la segunda diferencia (lo que el próximo tramo
+// se separaría de la curva) supera la tolerancia y se duplica cuando sobra margen, así
+// los tramos solo son cortos donde la curva se dobla. Cada paso son tres sumas por
+// coordenada. La tolerancia se fija en píxeles de ventana y se pasa al mundo con la
+// escala de la vista, redondeada a una potencia de 2 (el nivel) para poder reutilizar
+// el resultado mientras no se acerque o aleje mucho la vista.
+const double FLATTEN_TOLERANCE = 0.25;  // separación máxima de la curva, en píxeles
+const int FLATTEN_MAX_DEPTH = 16;       // paso mínimo en t: 2^-16
+const int FLATTEN_MAX_LEVEL = 24;
+
+struct CurvePoint {
+    double x, y;
+};
+
+struct Flattening {
+    int level;                  // tolerancia usada: 2^level unidades del mundo
+    vector<CurvePoint> points;  // vértices de la polilínea, del primer punto al último
+};
+
+int flattenLevel(double scale) {
+    int level = (int)floor(log2(FLATTEN_TOLERANCE / scale));
+    return max(-FLATTEN_MAX_LEVEL, min(FLATTEN_MAX_LEVEL, level));
+}
+
+// Añade los vértices del tramo p0..p3 sin repetir p0
+void flattenCubic(Point p0, Point p1, Point p2, Point p3, double tolerance, vector<CurvePoint>& out) {
+    // p(t) = a·t³ + b·t² + c·t + p0 y sus diferencias con paso h = 1
+    double ax = p3.x - p0.x + 3.0 * (p1.x - p2.x), ay = p3.y - p0.y + 3.0 * (p1.y - p2.y);
+    double bx = 3.0 * (p0.x - 2.0 * p1.x + p2.x), by = 3.0 * (p0.y - 2.0 * p1.y + p2.y);
+    double cx = 3.0 * (p1.x - p0.x), cy = 3.0 * (p1.y - p0.y);
+    double fx = p0.x, fy = p0.y;
+    double d1x = ax + bx + cx, d1y = ay + by + cy;
+    double d2x = 6 * ax + 2 * bx, d2y = 6 * ay + 2 * by;
+    double d3x = 6 * ax, d3y = 6 * ay;
+
+    // El tramo de t a t + h se separa de la curva como mucho max|p''|·h²/8. En una cúbica
+    // p'' es lineal, d2 = p''(t + h)·h² y d2 - d3 = p''(t)·h², así que basta con esos dos.
+    auto bend = [](double d2x, double d2y, double d3x, double d3y) {
+        return max(hypot(d2x, d2y), hypot(d2x - d3x, d2y - d3y));
+    };
+    double limit = 8 * tolerance;
+    const int end = 1 << FLATTEN_MAX_DEPTH;
+    int pos = 0, step = end;
+    while (pos < end) {
+        while (step > 1 && bend(d2x, d2y, d3x, d3y) > limit) {
+            d3x /= 8; d3y /= 8;
+            d2x = d2x / 4 - d3x; d2y = d2y / 4 - d3y;
+            d1x = (d1x - d2x) / 2; d1y = (d1y - d2y) / 2;
+            step /= 2;
+        }
+        // El paso doble debe caer en su rejilla para terminar justo en t = 1
+        while (step < end && pos % (2 * step) == 0 &&
+               2 * bend(4 * (d2x + d3x), 4 * (d2y + d3y), 8 * d3x, 8 * d3y) <= limit) {
+            d1x = 2 * d1x + d2x; d1y = 2 * d1y + d2y;
+            d2x = 4 * (d2x + d3x); d2y = 4 * (d2y + d3y);
+            d3x *= 8; d3y *= 8;
+            step *= 2;
+        }
+        fx += d1x; fy += d1y;
+        d1x += d2x; d1y += d2y;
+        d2x += d3x; d2y += d3y;
+        pos += step;
+        if (pos == end) out.push_back({(double)p3.x, (double)p3.y});
+        else out.push_back({fx, fy});
+    }
+}
+
+// Polilínea de una figura Bézier con la tolerancia 2^level, guardada en la propia figura:
+// se recalcula solo cuando cambia el nivel. Las figuras se comparten entre hilos
+// (exportaciones), así que la caché se lee y se sustituye de forma atómica.
+shared_ptr<const Flattening> flattenCurve(const Figure& figure, int level) {
+    shared_ptr<const Flattening> cached = atomic_load(&figure.flattening);
+    if (cached && cached->level == level) return cached;
+
+    auto flattening = make_shared<Flattening>();
+    flattening->level = level;
+    const vector<Point>& p = figure.points;
+    if (!p.empty()) flattening->points.push_back({(double)p[0].x, (double)p[0].y});
+    for (size_t i = 0; i + 3 < p.size(); i += 3) {
+        flattenCubic(p[i], p[i + 1], p[i + 2], p[i + 3], ldexp(1.0, level), flattening->points);
+    }
+    cached = flattening;
+    atomic_store(&figure.flattening, cached);
+    return cached;
+}
+
+// Funciones de dibujo auxiliares
+void drawGrid() {
+    TRACE_SCOPE("drawGrid");
+    // Al alejar, la separación crece en múltiplos de 5 para no bajar de 8 píxeles
+    double spacing = GRID_SPACING;
+    while (spacing * viewScale < 8) spacing *= 5;
+
+    glColor3f(0.9f, 0.9f, 0.9f);  // gris claro
+    glBegin(GL_LINES);
+    int lines = 0;
+    double left = viewX - (WIDTH/2) / viewScale, right = viewX + (WIDTH/2) / viewScale;
+    for (double wx = ceil(left / spacing) * spacing; wx <= right; wx += spacing, lines++) {
+        int x = (int)lround(projectX(wx));
+        glVertex2i(x, -HEIGHT/2);
+        glVertex2i(x, HEIGHT/2);
+    }
+    double bottom = viewY - (HEIGHT/2) / viewScale, top = viewY + (HEIGHT/2) / viewScale;
+    for (double wy = ceil(bottom / spacing) * spacing; wy <= top; wy += spacing, lines++) {
+        int y = (int)lround(projectY(wy));
+        glVertex2i(-WIDTH/2, y);
+        glVertex2i(WIDTH/2, y);
+    }
+    glEnd();
+    perf.glCalls += 3 + 2 * lines;
+}
+
+void drawAxes() {
+    TRACE_SCOPE("drawAxes");
+    glColor3f(0.0f, 0.0f, 0.0f);  // negro
+    glBegin(GL_LINES);
+    perf.glCalls += 2;
+    // Eje X
+    double y = projectY(0);
+    if (fabs(y) <= HEIGHT/2) {
+        glVertex2i(-WIDTH/2, (int)lround(y));
+        glVertex2i(WIDTH/2, (int)lround(y));
+        perf.glCalls += 2;
+    }
+    // Eje Y
+    double x = projectX(0);
+    if (fabs(x) <= WIDTH/2) {
+        glVertex2i((int)lround(x), -HEIGHT/2);
+        glVertex2i((int)lround(x), HEIGHT/2);
+        perf.glCalls += 2;
+    }
+    glEnd();
+    perf.glCalls++;
+}
+
+void clearFramebuffer(Framebuffer& fb, int width, int height) {
+    fb.width = width;
+    fb.height = height;
+    fb.originX = width/2;
+    fb.originY = height/2;
+    fb.rgb.assign(3 * width * height, 255);  // conserva la capacidad entre usos
+}
+
+// Líneas de 1 px en x = cte / y = cte, como GL_LINES sobre los bordes de píxel
+void drawVerticalFramebuffer(Framebuffer& fb, int x, unsigned char gray) {
+    int col = min(max(x + fb.originX, 0), fb.width - 1);
+    for (int row = 0; row < fb.height; row++)
+        memset(&fb.rgb[3 * (row * fb.width + col)], gray, 3);
+}
+
+void drawHorizontalFramebuffer(Framebuffer& fb, int y, unsigned char gray) {
+    int row = min(max(fb.originY - 1 - y, 0), fb.height - 1);
+    memset(&fb.rgb[3 * row * fb.width], gray, 3 * fb.width);
+}
+
+void renderFramebuffer(Framebuffer& fb, const FigureList& scene, bool grid, bool axes) {
+    TRACE_SCOPE("renderFramebuffer");
+    if (grid) {
+        for (int x = -fb.width/2; x <= fb.width/2; x += GRID_SPACING) drawVerticalFramebuffer(fb, x, 230);
+        for (int y = -fb.height/2; y <= fb.height/2; y += GRID_SPACING) drawHorizontalFramebuffer(fb, y, 230);
+    }
+    if (axes) {
+        drawHorizontalFramebuffer(fb, 0, 0);
+        drawVerticalFramebuffer(fb, 0, 0);
+    }
+
+    for (const auto& figure : scene) {
+        for (int i = 0; i < 3; i++) fb.color[i] = (unsigned char)lround(figure.color[i] * 255);
+        fb.thickness = figure.thickness;
+        if (fb.thickness == 1) {
+            FramebufferSink<true> sink(fb);
+            drawFigure(sink, figure);
+        } else {
+            FramebufferSink<false> sink(fb);
+            drawFigure(sink, figure);
+        }
+    }
+}
+
+// Relleno por inundación sobre una imagen ya rasterizada, por tramos con una pila de
+// semillas (Heckbert, Graphics Gems I): cada fila se extiende a izquierda y derecha de
+// una vez y solo se apilan los trozos de las filas vecinas que pueden seguir la región,
+// así la pila crece con los recovecos y no con el área. La región es la componente
+// 4-conexa del color de la semilla, que no se escapa entre los píxeles en diagonal de
+// un trazo. Los píxeles visitados se marcan en la imagen con otro color y los tramos
+// (fila y columnas, de arriba abajo) se devuelven en spans.
+void floodFillSpans(Framebuffer& fb, int col, int row, vector<StencilRun>& spans) {
+    spans.clear();
+    if (col < 0 || col >= fb.width || row < 0 || row >= fb.height) return;
+    unsigned char* rgb = fb.rgb.data();
+    int width = fb.width;
+    const unsigned char* seed = rgb + 3 * ((size_t)row * width + col);
+    const unsigned char old[3] = {seed[0], seed[1], seed[2]};
+    const unsigned char mark[3] = {(unsigned char)(old[0] ^ 1), old[1], old[2]};
+    auto matches = [&](int x, int y) {
+        const unsigned char* px = rgb + 3 * ((size_t)y * width + x);
+        return px[0] == old[0] && px[1] == old[1] && px[2] == old[2];
+    };
+    auto fill = [&](int y, int x0, int x1) {
+        fillRow(rgb + 3 * ((size_t)y * width + x0), x1 - x0 + 1, mark);
+        spans.push_back({y, x0, x1});
+    };
+
+    // Cada entrada es un tramo x0..x1 ya rellenado en la fila y que hay que continuar
+    // en la fila y + dy
+    struct Segment { int y, x0, x1, dy; };
+    vector<Segment> stack;
+    auto push = [&](int y, int x0, int x1, int dy) {
+        if (y + dy >= 0 && y + dy < fb.height) stack.push_back({y, x0, x1, dy});
+    };
+    push(row, col, col, 1);
+    push(row + 1, col, col, -1);
+    while (!stack.empty()) {
+        Segment s = stack.back();
+        stack.pop_back();
+        int y = s.y + s.dy, x = s.x0;
+        while (x >= 0 && matches(x, y)) x--;
+        int left = x + 1;
+        if (left <= s.x0) {
+            if (left < s.x0) push(y, left, s.x0 - 1, -s.dy);  // se sale por la izquierda
+            x = s.x0 + 1;
+        } else {
+            // x0 ya no es de la región: se busca el primer píxel que sí lo sea
+            for (x = s.x0 + 1; x <= s.x1 && !matches(x, y); x++) {}
+            if (x > s.x1) continue;
+            left = x;
+        }
+        for (;;) {
+            while (x < width && matches(x, y)) x++;
+            fill(y, left, x - 1);
+            push(y, left, x - 1, s.dy);
+            if (x > s.x1 + 1) push(y, s.x1 + 1, x - 1, -s.dy);  // se sale por la derecha
+            for (x++; x <= s.x1 && !matches(x, y); x++) {}
+            if (x > s.x1) break;
+            left = x;
+        }
+    }
+}
+
+// Texto de la capa superior: cada glifo se compila una vez en una lista de
+// visualización y cada cadena se dibuja con una sola llamada a glCallLists.
+void buildGlyphAtlas() {
+    glyphBase = glGenLists(128);
+    for (int c = 0; c < 128; c++) {
+        glNewList(glyphBase + c, GL_COMPILE);
+        glutBitmapCharacter(GLUT_BITMAP_9_BY_15, c);
+        glEndList();
+    }
+}
+
+// Proyección en píxeles de ventana (origen arriba a la izquierda) para la capa superior
+void beginHud() {
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glLoadIdentity();
+    gluOrtho2D(0, WIDTH, HEIGHT, 0);
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadIdentity();
+    perf.glCalls += 7;  // gluOrtho2D emite un glOrtho
+}
+
+void endHud() {
+    glPopMatrix();
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+    perf.glCalls += 4;
+}
+
+void drawHudText(int x, int y, const string& text) {
+    glRasterPos2i(x, y);
+    glListBase(glyphBase);
+    glCallLists((GLsizei)text.size(), GL_UNSIGNED_BYTE, text.data());
+    perf.glCalls += 3;
+}
+
+void displayCoordinates() {
+    beginHud();
+    glColor3f(0.0f, 0.0f, 0.0f);
+    perf.glCalls++;
+    Point p = screenToWorld(mouseX - WIDTH/2, HEIGHT/2 - mouseY);
+    string text = "X: " + to_string(p.x) + " Y: " + to_string(p.y);
+    if (viewScale != 1.0) {
+        char zoom[32];
+        snprintf(zoom, sizeof(zoom), "  Zoom: %g", viewScale);
+        text += zoom;
+    }
+    drawHudText(10, 20, text);
+    endHud();
+}
+
+string formatMs(double ms) {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.2f ms", ms);
+    return buffer;
+}
+
+void printPerf(ostream& out) {
+    out << "Frame " << perf.frames << " (" << perf.redisplayRequests << " peticiones): " << formatMs(perf.frameMs)
+        << (perf.sceneCached ? " (escena en cache)" : "") << ", " << perf.glCalls << " llamadas GL, "
+        << perf.figureCount << " figuras" << endl;
+    out << "  Escena: " << formatMs(perf.sceneMs) << ", " << perf.culledFigures << " fuera de vista, "
+        << perf.pointFigures << " reducidas a un punto, " << perf.repeatedPixels << " px repetidos evitados" << endl;
+    for (int t = 0; t < FIGURE_TYPES; t++) {
+        out << "  " << figureTypeNames[t] << ": " << formatMs(perf.rasterMs[t]) << ", "
+            << perf.pixels[t] << " px" << endl;
+    }
+    out << "  Exportacion: lectura " << formatMs(perf.exportReadMs) << ", codificacion "
+        << formatMs(perf.exportEncodeMs) << ", escritura " << formatMs(perf.exportWriteMs)
+        << ", total " << formatMs(perf.exportTotalMs) << endl;
+    out << "  Plantillas: " << stencilCache.entries.size() << " (" << stencilCache.bytes / 1024 << " KB), "
+        << stencilCache.hits << " aciertos, " << stencilCache.misses << " fallos, " << stencilCache.evictions
+        << " descartadas, " << stencilCache.bypassed << " sin cache" << endl;
+    out << "  Repetidos evitados (total): " << overdrawTotal.incremental << " circulo incremental, "
+        << overdrawTotal.midpoint << " punto medio, " << overdrawTotal.paths << " vertices de polilineas, "
+        << overdrawTotal.conics << " conicas" << endl;
+}
+
+// Panel de rendimiento en la capa superior
+void displayPerf() {
+    beginHud();
+    glColor3f(0.0f, 0.0f, 0.0f);
+    perf.glCalls++;
+    int y = 40;
+    drawHudText(10, y, "Frame: " + formatMs(perf.frameMs) + (perf.sceneCached ? " (cache)" : ""));
+    drawHudText(10, y += 16, "Figuras: " + to_string(perf.figureCount) + "  GL: " + to_string(perf.glCalls));
+    drawHudText(10, y += 16, "Escena: " + formatMs(perf.sceneMs) + "  Fuera: " + to_string(perf.culledFigures) +
+                             "  Punto: " + to_string(perf.pointFigures) +
+                             "  Repetidos evitados: " + to_string(perf.repeatedPixels));
+    for (int t = 0; t < FIGURE_TYPES; t++) {
+        drawHudText(10, y += 16, string(figureTypeNames[t]) + ": " + formatMs(perf.rasterMs[t]) +
+                                 ", " + to_string(perf.pixels[t]) + " px");
+    }
+    drawHudText(10, y += 16, "Exportar: " + formatMs(perf.exportTotalMs));
+    drawHudText(10, y += 16, "Plantillas: " + to_string(stencilCache.entries.size()) + "  Aciertos: " +
+                             to_string(stencilCache.hits) + "  Fallos: " + to_string(stencilCache.misses));
+    endHud();
+}
+
+int circleRadius(const Figure& figure) {
+    double dx = (double)figure.points[1].x - figure.points[0].x;
+    double dy = (double)figure.points[1].y - figure.points[0].y;
+    return (int)sqrt(dx*dx + dy*dy);
+}
+
+int ellipseRx(const Figure& figure) {
+    return abs(figure.points[1].x - figure.points[0].x);
+}
+
+int ellipseRy(const Figure& figure) {
+    return abs(figure.points[2].y - figure.points[0].y);
+}
+
+// Recorta el segmento a la caja (Liang-Barsky). Devuelve false si queda fuera.
+bool clipSegment(double& x0, double& y0, double& x1, double& y1,
+                 double xmin, double ymin, double xmax, double ymax) {
+    double t0 = 0, t1 = 1;
+    double dx = x1 - x0, dy = y1 - y0;
+    double p[4] = {-dx, dx, -dy, dy};
+    double q[4] = {x0 - xmin, xmax - x0, y0 - ymin, ymax - y0};
+    for (int i = 0; i < 4; i++) {
+        if (p[i] == 0) {
+            if (q[i] < 0) return false;
+            continue;
+        }
+        double t = q[i] / p[i];
+        if (p[i] < 0) t0 = max(t0, t);
+        else t1 = min(t1, t);
+        if (t0 > t1) return false;
+    }
+    double sx = x0, sy = y0;
+    x0 = sx + t0 * dx; y0 = sy + t0 * dy;
+    x1 = sx + t1 * dx; y1 = sy + t1 * dy;
+    return true;
+}
+
+// Círculo o elipse mucho mayor que la ventana: se evalúa directamente solo en las
+// columnas y filas visibles. Cada columna pinta el tramo de pendiente suave y cada
+// fila el de pendiente fuerte, igual que reparten las dos regiones del punto medio;
+// donde se encuentran, la fila no repite los píxeles que ya pintó su columna.
+template <class Sink>
+void drawConicClipped(Sink& sink, double cx, double cy, double rx, double ry,
+                      double xmin, double ymin, double xmax, double ymax) {
+    // Píxeles de la columna x: arriba y abajo (iguales si solo hay uno), o ninguno
+    auto column = [&](int x, int& top, int& bottom) {
+        double dx = x - cx;
+        double dy = ry * sqrt(max(0.0, 1 - (dx / rx) * (dx / rx)));
+        if (ry * ry * fabs(dx) > rx * rx * dy) return false;
+        top = (int)lround(cy + dy);
+        bottom = (int)lround(cy - dy);
+        return true;
+    };
+    int xa = (int)max(xmin, ceil(cx - rx)), xb = (int)min(xmax, floor(cx + rx));
+    for (int x = xa; x <= xb; x++) {
+        int top, bottom;
+        if (!column(x, top, bottom)) continue;
+        if (top >= ymin && top <= ymax) sink.plot(x, top);
+        if (bottom != top && bottom >= ymin && bottom <= ymax) sink.plot(x, bottom);
+    }
+
+    auto plotRow = [&](int x, int y) {
+        int top, bottom;
+        if (x >= xa && x <= xb && column(x, top, bottom) && (y == top || y == bottom)) countOverdraw(sink, &OverdrawCounters::conics, 1);
+        else sink.plot(x, y);
+    };
+    int ya = (int)max(ymin, ceil(cy - ry)), yb = (int)min(ymax, floor(cy + ry));
+    for (int y = ya; y <= yb; y++) {
+        double dy = y - cy;
+        double dx = rx * sqrt(max(0.0, 1 - (dy / ry) * (dy / ry)));
+        if (ry * ry * dx >= rx * rx * fabs(dy)) continue;
+        int right = (int)lround(cx + dx), left = (int)lround(cx - dx);
+        if (right >= xmin && right <= xmax) plotRow(right, y);
+        if (left != right && left >= xmin && left <= xmax) plotRow(left, y);
+    }
+}
+
+// Elipses giradas y arcos. La cónica centrada en el origen F(x, y) = A x² + B xy + C y² - D
+// (negativa dentro) se recorre en sentido antihorario de píxel en píxel, como en el punto
+// medio para cónicas de Pitteway y Van Aken: el octante de la normal da el eje de avance
+// d1 y el secundario d2, y el signo de F en el punto medio entre P + d1 y P + d1 + d2 elige
+// el siguiente píxel. F y su gradiente avanzan por diferencias en punto fijo, sin
+// trigonometría por píxel, y un arco solo visita sus propios píxeles.
+struct Conic {
+    double A, B, C, D;
+};
+
+struct EllipseShape {
+    double a, b;        // semiejes
+    double cosT, sinT;  // dirección del semieje a
+};
+
+Conic ellipseConic(const EllipseShape& e) {
+    double a2 = e.a * e.a, b2 = e.b * e.b, c = e.cosT, s = e.sinT;
+    return {b2 * c * c + a2 * s * s, 2 * (b2 - a2) * s * c, b2 * s * s + a2 * c * c, a2 * b2};
+}
+
+// Punto de la cónica en la dirección (ux, uy) desde el centro
+CurvePoint conicPointInDirection(const Conic& k, CurvePoint u) {
+    double q = k.A * u.x * u.x + k.B * u.x * u.y + k.C * u.y * u.y;
+    double t = q > 0 ? sqrt(k.D / q) : 0;
+    return {t * u.x, t * u.y};
+}
+
+// ¿Está la dirección (x, y) dentro del arco antihorario de from a to?
+bool inArc(CurvePoint from, CurvePoint to, bool closed, double x, double y) {
+    if (closed) return true;
+    auto cross = [](double ax, double ay, double bx, double by) { return ax * by - ay * bx; };
+    if (cross(from.x, from.y, to.x, to.y) >= 0) {
+        return cross(from.x, from.y, x, y) >= 0 && cross(x, y, to.x, to.y) >= 0;
+    }
+    // Más de media vuelta: dentro salvo en el hueco de to a from
+    return !(cross(to.x, to.y, x, y) > 0 && cross(x, y, from.x, from.y) > 0);
+}
+
+// Recorre el arco desde la dirección from hasta to alrededor del centro entero c (con
+// closed, la elipse entera). Como el punto medio de elipses alineadas, la curva se parte
+// en octantes donde la normal cruza un eje o una diagonal: dentro de cada uno el eje de
+// avance y hacia qué lado queda el interior no cambian, así que cada paso es un único
+// signo de F en el punto medio, y el tramo termina justo en el píxel de su extremo. Pide
+// puntas con radio de curvatura de al menos un cuarto de píxel (ver drawEllipseArc).
+// Los coeficientes se escalan por 2^f / R² con tantos
+// bits fraccionarios como deja el semieje mayor R, así 4F cabe en 64 bits.
+template <class Sink>
+void traceConicArc(Sink& sink, Point c, const Conic& k, double R, CurvePoint from, CurvePoint to, bool closed) {
+    int bits = 1;
+    while ((1LL << bits) < R + 2) bits++;
+    double scale = ldexp(1.0, 56 - 2 * bits) / (R * R);
+    long long A = llround(k.A * scale), B = llround(k.B * scale), C = llround(k.C * scale);
+    long long D = llround(k.D * scale);
+    auto Q = [&](long long vx, long long vy) { return A * vx * vx + B * vx * vy + C * vy * vy; };
+
+    // Puntos con normal (1,0), (1,1), (0,1), ... en orden antihorario: el octante i va del
+    // punto i al i + 1 y en él la tangente avanza en d1 (eje dominante) y a veces en d2
+    static const int normalX[8] = {1, 1, 0, -1, -1, -1, 0, 1}, normalY[8] = {0, 1, 1, 1, 0, -1, -1, -1};
+    static const int d1X[8] = {0, -1, -1, 0, 0, 1, 1, 0}, d1Y[8] = {1, 0, 0, -1, -1, 0, 0, 1};
+    static const int d2X[8] = {-1, 0, 0, -1, 1, 0, 0, 1}, d2Y[8] = {0, 1, -1, 0, 0, -1, 1, 0};
+    CurvePoint split[8];
+    for (int i = 0; i < 8; i++) {
+        double px = k.C * normalX[i] - k.B / 2 * normalY[i], py = k.A * normalY[i] - k.B / 2 * normalX[i];
+        double s = sqrt(k.D / (k.A * px * px + k.B * px * py + k.C * py * py));
+        split[i] = {px * s, py * s};
+    }
+    auto octantOf = [&](CurvePoint u) {
+        for (int i = 0; i < 7; i++) {
+            if (inArc(split[i], split[i + 1], false, u.x, u.y)) return i;
+        }
+        return 7;
+    };
+    auto pixelOf = [](CurvePoint q) { return Point((int)llround(q.x), (int)llround(q.y)); };
+
+    int octant = closed ? 0 : octantOf(from), endOctant = closed ? 7 : octantOf(to);
+    Point cur = closed ? pixelOf(split[0]) : pixelOf(conicPointInDirection(k, from));
+    Point end = closed ? cur : pixelOf(conicPointInDirection(k, to));
+    // Si el final cae en el octante de inicio pero por detrás, hay que dar la vuelta
+    bool wrap = !closed && endOctant == octant && from.x * to.y - from.y * to.x < 0;
+
+    long long x = cur.x, y = cur.y;
+    long long F = 4 * (Q(x, y) - D);                                   // 4 F(x, y)
+    long long gx = 4 * A * x + 2 * B * y, gy = 2 * B * x + 4 * C * y;  // 2 ∇F(x, y)
+    sink.plot(c.x + cur.x, c.y + cur.y);
+
+    // Sin repetidos: en una punta aguda el primer paso de un octante puede deshacer el
+    // último del anterior, y al cerrar la vuelta (o en un arco de casi una vuelta) el
+    // camino puede pasar por los primeros píxeles, todos a menos de 4 del inicio
+    Point first[4] = {cur, cur, cur, cur};
+    int firsts = 1, lastDx = 0, lastDy = 0;
+
+    for (;;) {
+        bool last = octant == endOctant && !wrap;
+        Point target = last ? end : pixelOf(split[(octant + 1) % 8]);
+        int d1x = d1X[octant], d1y = d1Y[octant], d2x = d2X[octant], d2y = d2Y[octant];
+        // d2 mira hacia fuera si la normal, entre sus dos extremos, tiene componente a favor
+        bool d2Outward = (normalX[octant] + normalX[(octant + 1) % 8]) * d2x
+                         + (normalY[octant] + normalY[(octant + 1) % 8]) * d2y > 0;
+        long long vx = 2 * d1x + d2x, vy = 2 * d1y + d2y;
+        while (x != target.x || y != target.y) {
+            int dx, dy;
+            bool majorDone = d1x ? x == target.x : y == target.y;
+            bool minorDone = d2x ? x == target.x : y == target.y;
+            if (majorDone) {
+                dx = d2x; dy = d2y;
+            } else if (minorDone) {
+                dx = d1x; dy = d1y;
+            } else {
+                // La curva pasa más allá del punto medio entre P + d1 y P + d1 + d2
+                long long mid = F + gx * vx + gy * vy + Q(vx, vy);  // 4 F en el punto medio
+                bool diagonal = d2Outward ? mid < 0 : mid > 0;
+                dx = d1x + (diagonal ? d2x : 0);
+                dy = d1y + (diagonal ? d2y : 0);
+            }
+            F += 2 * (gx * dx + gy * dy) + 4 * Q(dx, dy);
+            gx += 4 * A * dx + 2 * B * dy;
+            gy += 2 * B * dx + 4 * C * dy;
+            x += dx;
+            y += dy;
+            if (closed && last && x == target.x && y == target.y) break;  // el primer píxel ya está
+            bool repeated = dx == -lastDx && dy == -lastDy;
+            lastDx = dx;
+            lastDy = dy;
+            if (llabs(x - first[0].x) <= 3 && llabs(y - first[0].y) <= 3) {
+                for (int i = 0; i < firsts && !repeated; i++) repeated = x == first[i].x && y == first[i].y;
+                if (!repeated && firsts < 4) first[firsts++] = Point((int)x, (int)y);
+            }
+            if (repeated) countOverdraw(sink, &OverdrawCounters::conics, 1);
+            else sink.plot(c.x + (int)x, c.y + (int)y);
+        }
+        if (last) break;
+        if (octant == endOctant) wrap = false;
+        octant = (octant + 1) % 8;
+    }
+}
+
+// Elipse o arco mucho mayor que la ventana: como drawConicClipped, se resuelve la cónica
+// en cada columna visible para los tramos de pendiente suave y en cada fila para los de
+// pendiente fuerte, y solo se pintan los puntos dentro del arco. Con bothRoots se pintan
+// todas las soluciones: cerca de una punta muy aguda la pendiente cambia tanto entre la
+// raíz de la columna y la de la fila que el reparto por pendiente deja huecos.
+template <class Sink>
+void drawConicArcClipped(Sink& sink, double cx, double cy, Conic k, CurvePoint from, CurvePoint to, bool closed,
+                         double xmin, double ymin, double xmax, double ymax, bool bothRoots = false) {
+    // Filas que pinta la columna X (una o dos distintas); sirve también para que la
+    // pasada por filas no las repita
+    auto column = [&](int X, int rows[2]) {
+        int n = 0;
+        double x = X - cx;
+        double disc = k.B * k.B * x * x - 4 * k.C * (k.A * x * x - k.D);
+        if (disc < 0 || k.C <= 0) return 0;
+        for (int sign : {-1, 1}) {
+            double y = (-k.B * x + sign * sqrt(disc)) / (2 * k.C);
+            if (!bothRoots && fabs(2 * k.A * x + k.B * y) > fabs(k.B * x + 2 * k.C * y)) continue;
+            int Y = (int)lround(cy + y);
+            if (Y >= ymin && Y <= ymax && inArc(from, to, closed, x, y) && (n == 0 || rows[0] != Y)) rows[n++] = Y;
+        }
+        return n;
+    };
+    int xa = (int)ceil(xmin), xb = (int)floor(xmax);
+    for (int X = xa; X <= xb; X++) {
+        int rows[2];
+        int n = column(X, rows);
+        for (int i = 0; i < n; i++) sink.plot(X, rows[i]);
+    }
+    for (int Y = (int)ceil(ymin); Y <= (int)floor(ymax); Y++) {
+        double y = Y - cy;
+        double disc = k.B * k.B * y * y - 4 * k.A * (k.C * y * y - k.D);
+        if (disc < 0 || k.A <= 0) continue;
+        int previous = INT_MIN;
+        for (int sign : {-1, 1}) {
+            double x = (-k.B * y + sign * sqrt(disc)) / (2 * k.A);
+            if (!bothRoots && fabs(2 * k.A * x + k.B * y) <= fabs(k.B * x + 2 * k.C * y)) continue;
+            int X = (int)lround(cx + x);
+            if (X < xmin || X > xmax || !inArc(from, to, closed, x, y)) continue;
+            int rows[2];
+            int n = X == previous ? 0 : column(X, rows);
+            bool repeated = X == previous || (n > 0 && rows[0] == Y) || (n > 1 && rows[1] == Y);
+            previous = X;
+            if (repeated) countOverdraw(sink, &OverdrawCounters::conics, 1);
+            else sink.plot(X, Y);
+        }
+    }
+}
+
+thread_local vector<Point> sharpTipPixels;  // búfer de drawEllipseArc para puntas agudas
+
+// Elipse girada o arco con centro (cx, cy) en píxeles: se descarta si su caja queda fuera,
+// se reduce a un punto si es menor que un píxel, se recorta si es enorme y si no se
+// recorre con traceConicArc. Sin anchura (b < 0.5) la elipse o el arco quedan en el
+// segmento del eje mayor, y las de punta muy aguda se resuelven por columnas y filas.
+template <class Sink>
+int drawEllipseArc(Sink& sink, double cx, double cy, const EllipseShape& e, CurvePoint from, CurvePoint to,
+                   bool closed, double xmin, double ymin, double xmax, double ymax) {
+    double hx = hypot(e.a * e.cosT, e.b * e.sinT), hy = hypot(e.a * e.sinT, e.b * e.cosT);
+    if (cx + hx < xmin || cx - hx > xmax || cy + hy < ymin || cy - hy > ymax) return LOD_CULLED;
+    if (e.a < 0.5 && e.b < 0.5) {
+        sink.plot((int)lround(cx), (int)lround(cy));
+        return LOD_POINT;
+    }
+    double R = max(e.a, e.b);
+    if (R > CLIP_GUARD) {
+        Conic k = ellipseConic({e.a / R, e.b / R, e.cosT, e.sinT});  // normalizada: sin desbordes
+        k.D *= R * R;
+        drawConicArcClipped(sink, cx, cy, k, from, to, closed, xmin, ymin, xmax, ymax);
+        return LOD_FULL;
+    }
+    Point center((int)lround(cx), (int)lround(cy));
+    if (min(e.a, e.b) < 0.5) {
+        // Sin anchura la curva es el eje mayor: la elipse, el segmento entero; el arco, el
+        // tramo que recorre su ángulo paramétrico (cos φ o sin φ a lo largo del eje).
+        bool alongA = e.a >= e.b;
+        double ax = alongA ? R * e.cosT : -R * e.sinT, ay = alongA ? R * e.sinT : R * e.cosT;
+        double lo = -1, hi = 1;
+        if (!closed) {
+            auto angle = [&](CurvePoint d) {
+                double du = d.x * e.cosT + d.y * e.sinT, dv = d.y * e.cosT - d.x * e.sinT;
+                return atan2(e.a * dv, e.b * du);
+            };
+            auto along = [alongA](double phi) { return alongA ? cos(phi) : sin(phi); };
+            double start = angle(from), sweep = angle(to) - start;
+            if (sweep < 0) sweep += 2 * M_PI;
+            lo = min(along(start), along(start + sweep));
+            hi = max(along(start), along(start + sweep));
+            for (int k = 0; k < 4; k++) {
+                double phi = k * M_PI / 2;
+                if (fmod(phi - start + 4 * M_PI, 2 * M_PI) > sweep) continue;
+                lo = min(lo, along(phi));
+                hi = max(hi, along(phi));
+            }
+        }
+        drawLineDDA(sink, Point((int)lround(cx + lo * ax), (int)lround(cy + lo * ay)),
+                    Point((int)lround(cx + hi * ax), (int)lround(cy + hi * ay)));
+        return LOD_FULL;
+    }
+    if (min(e.a, e.b) * min(e.a, e.b) < R / 4) {
+        // Punta con radio de curvatura b² / a menor de un cuarto de píxel: las dos ramas
+        // comparten píxeles y el trazado incremental podría seguir la que no toca. Las
+        // puntas no caen en ninguna columna ni fila resuelta y se añaden aparte.
+        // Las puntas pueden coincidir con una solución ya pintada: se ordena y cada píxel
+        // se emite una vez.
+        vector<Point>& pixels = sharpTipPixels;
+        pixels.clear();
+        CaptureSink capture(pixels);
+        drawConicArcClipped(capture, center.x, center.y, ellipseConic(e), from, to, closed, max(xmin, center.x - hx - 1),
+                            max(ymin, center.y - hy - 1), min(xmax, center.x + hx + 1), min(ymax, center.y + hy + 1),
+                            true);
+        double ax = e.a > e.b ? e.a * e.cosT : -e.b * e.sinT, ay = e.a > e.b ? e.a * e.sinT : e.b * e.cosT;
+        for (int sign : {-1, 1}) {
+            int X = center.x + (int)lround(sign * ax), Y = center.y + (int)lround(sign * ay);
+            if (X >= xmin && X <= xmax && Y >= ymin && Y <= ymax && inArc(from, to, closed, sign * ax, sign * ay)) {
+                capture.plot(X, Y);
+            }
+        }
+        sort(pixels.begin(), pixels.end(), [](const Point& p, const Point& q) {
+            return p.y != q.y ? p.y < q.y : p.x < q.x;
+        });
+        for (size_t i = 0; i < pixels.size(); i++) {
+            if (i > 0 && pixels[i].x == pixels[i - 1].x && pixels[i].y == pixels[i - 1].y) countOverdraw(sink, &OverdrawCounters::conics, 1);
+            else sink.plot(pixels[i].x, pixels[i].y);
+        }
+        return LOD_FULL;
+    }
+    traceConicArc(sink, center, ellipseConic(e), R, from, to, closed);
+    return LOD_FULL;
+}
+
+// Forma de las figuras 10 a 12. La elipse girada tiene el semieje a hasta points[1] y b
+// igual a la distancia de points[2] a la recta de ese eje; el arco de circunferencia,
+// a = b = distancia del centro a points[1].
+EllipseShape figureEllipseShape(const Figure& figure) {
+    const vector<Point>& p = figure.points;
+    double ux = (double)p[1].x - p[0].x, uy = (double)p[1].y - p[0].y;
+    double a = hypot(ux, uy);
+    EllipseShape e = {a, a, 1, 0};
+    if (a > 0) {
+        e.cosT = ux / a;
+        e.sinT = uy / a;
+        if (figure.type != CIRCLE_ARC_TYPE) {
+            double vx = (double)p[2].x - p[0].x, vy = (double)p[2].y - p[0].y;
+            e.b = fabs(ux * vy - uy * vx) / a;
+        }
+    }
+    return e;
+}
+
+// Direcciones inicial y final (antihorario) de una figura 10 a 12, relativas al centro.
+// La elipse girada, o un arco que vuelve a su inicio, es cerrada.
+void figureArcRange(const Figure& figure, const EllipseShape& e, CurvePoint& from, CurvePoint& to, bool& closed) {
+    const vector<Point>& p = figure.points;
+    auto direction = [&](size_t i) {
+        CurvePoint d = {(double)p[i].x - p[0].x, (double)p[i].y - p[0].y};
+        if (d.x == 0 && d.y == 0) d = {e.cosT, e.sinT};
+        return d;
+    };
+    if (figure.type == ROTATED_ELLIPSE_TYPE) {
+        from = to = {e.cosT, e.sinT};
+    } else if (figure.type == CIRCLE_ARC_TYPE) {
+        from = direction(1);
+        to = direction(2);
+    } else {
+        from = direction(3);
+        to = direction(4);
+    }
+    closed = from.x * to.y - from.y * to.x == 0 && from.x * to.x + from.y * to.y > 0;
+}
+
+size_t ellipseArcPoints(int type) {
+    return type == ELLIPSE_ARC_TYPE ? 5 : 3;
+}
+
+// Descarta el píxel del vértice que un tramo comparte con el anterior: la DDA lo emite
+// como primer píxel del tramo siguiente
+template <class Sink>
+struct JoinSink {
+    Sink& sink;
+    Point joint;
+    void plot(int x, int y) {
+        if (x == joint.x && y == joint.y) {
+            joint.x = INT_MIN;
+            countOverdraw(sink, &OverdrawCounters::paths, 1);
+            return;
+        }
+        sink.plot(x, y);
+    }
+};
+
+// Polilínea en coordenadas del mundo: la DDA entre los vértices redondeados. Un tramo
+// que se queda en el mismo píxel solo se dibuja si es el primero, y cada vértice
+// interior se pinta una sola vez.
+template <class Sink, class Vertex>
+void drawPath(Sink& sink, size_t n, Vertex vertex) {
+    if (n < 2) return;
+    CurvePoint v = vertex(0);
+    Point a((int)lround(v.x), (int)lround(v.y));
+    for (size_t i = 1; i < n; i++) {
+        v = vertex(i);
+        Point b((int)lround(v.x), (int)lround(v.y));
+        if (i == 1) {
+            drawLineDDA(sink, a, b);
+        } else if (b.x != a.x || b.y != a.y) {
+            JoinSink<Sink> join{sink, a};
+            drawLineDDA(join, a, b);
+        }
+        a = b;
+    }
+}
+
+// La misma polilínea en la vista: cada tramo se descarta o recorta como una recta suelta
+// y solo se salta su primer píxel si es el último del tramo anterior dibujado
+template <class Sink, class Vertex>
+void drawPathInView(Sink& sink, size_t n, Vertex vertex, double xmin, double ymin, double xmax, double ymax) {
+    if (n < 2) return;
+    CurvePoint v = vertex(0);
+    double ax = projectX(v.x), ay = projectY(v.y);
+    Point last(INT_MIN, INT_MIN);  // último píxel del tramo anterior dibujado
+    for (size_t i = 1; i < n; i++) {
+        v = vertex(i);
+        double x0 = ax, y0 = ay, x1 = projectX(v.x), y1 = projectY(v.y);
+        ax = x1;
+        ay = y1;
+        if (max(x0, x1) < xmin || min(x0, x1) > xmax || max(y0, y1) < ymin || min(y0, y1) > ymax) continue;
+        if (min(x0, x1) < -CLIP_GUARD || max(x0, x1) > CLIP_GUARD ||
+            min(y0, y1) < -CLIP_GUARD || max(y0, y1) > CLIP_GUARD) {
+            if (!clipSegment(x0, y0, x1, y1, xmin, ymin, xmax, ymax)) continue;
+        }
+        Point a((int)lround(x0), (int)lround(y0)), b((int)lround(x1), (int)lround(y1));
+        if (i == 1 || b.x != a.x || b.y != a.y) {
+            JoinSink<Sink> join{sink, last};
+            drawLineDDA(join, a, b);
+            last = b;
+        }
+    }
+}
+
+// Relleno de polígonos por líneas de barrido con tabla de bordes activos. Cada fila se
+// muestrea en los centros de píxel (los puntos enteros): el píxel x entra si queda entre
+// dos cruces, x_izq <= x < x_der, y cada borde cubre las filas y_min <= y < y_max, así
+// dos polígonos que comparten un lado no se pisan ni dejan huecos. La x de cada borde
+// avanza en enteros exactos, como el error de Bresenham: sin deriva en bordes largos.
+struct PolygonEdge {
+    int yEnd;           // primera fila que el borde ya no cruza
+    int x, err;         // x = techo del cruce; x - cruce = err / dy, con 0 <= err < dy
+    int step, rem, dy;  // por fila el cruce avanza step + rem / dy
+    int winding;        // +1 si el borde sube, -1 si baja
+};
+
+long long floorDiv(long long a, long long d) {  // d > 0
+    long long q = a / d;
+    return q - (a % d < 0 ? 1 : 0);
+}
+
+// Rellena el polígono cerrado v solo en las filas y columnas de la caja. Los vértices
+// deben estar dentro de la banda de guarda (ver fillPolygonClipped).
+template <class Sink>
+void fillPolygon(Sink& sink, const vector<Point>& v, bool nonzero, int xmin, int ymin, int xmax, int ymax) {
+    size_t n = v.size();
+    if (n < 3) return;
+    int bottom = v[0].y, top = v[0].y;
+    for (const Point& q : v) {
+        bottom = min(bottom, q.y);
+        top = max(top, q.y);
+    }
+    ymin = max(ymin, bottom);
+    ymax = min(ymax, top - 1);
+    if (ymin > ymax) return;
+
+    // Tabla de bordes: cada borde se apunta en la lista de la fila donde empieza a verse
+    vector<int> head(ymax - ymin + 1, -1), next;
+    vector<PolygonEdge> edges;
+    edges.reserve(n);
+    next.reserve(n);
+    for (size_t i = 0; i < n; i++) {
+        Point a = v[i], b = v[i + 1 < n ? i + 1 : 0];
+        if (a.y == b.y) continue;  // los lados horizontales no cruzan ninguna fila
+        PolygonEdge e;
+        e.winding = a.y < b.y ? 1 : -1;
+        if (a.y > b.y) swap(a, b);
+        int first = max(a.y, ymin);
+        if (first >= b.y || first > ymax) continue;
+        e.yEnd = b.y;
+        e.dy = b.y - a.y;
+        int dx = b.x - a.x;
+        e.step = (int)floorDiv(dx, e.dy);
+        e.rem = dx - e.step * e.dy;
+        long long cross = (long long)a.x * e.dy + (long long)(first - a.y) * dx;  // cruce · dy
+        long long x = -floorDiv(-cross, e.dy);
+        e.x = (int)x;
+        e.err = (int)(x * e.dy - cross);
+        next.push_back(head[first - ymin]);
+        head[first - ymin] = (int)edges.size();
+        edges.push_back(e);
+    }
+
+    vector<PolygonEdge> active;
+    for (int y = ymin; y <= ymax; y++) {
+        for (int i = head[y - ymin]; i >= 0; i = next[i]) active.push_back(edges[i]);
+        active.erase(remove_if(active.begin(), active.end(), [y](const PolygonEdge& e) { return e.yEnd <= y; }),
+                     active.end());
+
+        // De una fila a otra el orden apenas cambia y la inserción es casi lineal. Si los
+        // bordes se cruzan mucho (polígonos con miles de lados enredados) se pasa a sort.
+        size_t moves = 0, maxMoves = 8 * active.size();
+        for (size_t i = 1; i < active.size(); i++) {
+            PolygonEdge e = active[i];
+            size_t j = i;
+            for (; j > 0 && active[j - 1].x > e.x; j--) active[j] = active[j - 1];
+            active[j] = e;
+            moves += i - j;
+            if (moves > maxMoves) {
+                sort(active.begin(), active.end(), [](const PolygonEdge& a, const PolygonEdge& b) { return a.x < b.x; });
+                break;
+            }
+        }
+
+        // Los tramos seguidos por dentro se unen: cada píxel se escribe una sola vez
+        int winding = 0, start = 0;
+        for (const PolygonEdge& e : active) {
+            bool wasInside = nonzero ? winding != 0 : (winding & 1) != 0;
+            winding += nonzero ? e.winding : 1;
+            bool inside = nonzero ? winding != 0 : (winding & 1) != 0;
+            if (inside && !wasInside) {
+                start = e.x;
+            } else if (!inside && wasInside) {
+                int x0 = max(start, xmin), x1 = min(e.x - 1, xmax);
+                if (x0 <= x1) sink.plotSpan(y, x0, x1);
+            }
+        }
+
+        for (PolygonEdge& e : active) {
+            e.x += e.step;
+            e.err -= e.rem;
+            if (e.err < 0) {
+                e.x++;
+                e.err += e.dy;
+            }
+        }
+    }
+}
+
+// Recorta el polígono a la caja |x|, |y| <= limit, un lado cada vez (Sutherland-Hodgman).
+// Lo que sale se sustituye por tramos sobre el lado, así dentro de la caja cada punto
+// conserva su número de vueltas y las dos reglas de relleno dan lo mismo que sin recortar.
+void clipPolygon(vector<CurvePoint>& poly, double limit) {
+    vector<CurvePoint> out;
+    for (int side = 0; side < 4 && !poly.empty(); side++) {
+        // Lados x <= limit, -x <= limit, y <= limit, -y <= limit
+        auto value = [side](const CurvePoint& q) {
+            double c = side < 2 ? q.x : q.y;
+            return side % 2 ? -c : c;
+        };
+        out.clear();
+        for (size_t i = 0; i < poly.size(); i++) {
+            const CurvePoint& a = poly[i];
+            const CurvePoint& b = poly[i + 1 < poly.size() ? i + 1 : 0];
+            double va = value(a), vb = value(b);
+            if (va <= limit) out.push_back(a);
+            if ((va <= limit) != (vb <= limit)) {
+                double t = (limit - va) / (vb - va);
+                out.push_back({a.x + t * (b.x - a.x), a.y + t * (b.y - a.y)});
+            }
+        }
+        poly.swap(out);
+    }
+}
+
+// Polígono en píxeles (dobles): si sale de la banda de guarda se recorta a ella antes
+// de redondear los vértices, así los cruces siempre caben en enteros
+template <class Sink>
+void fillPolygonClipped(Sink& sink, vector<CurvePoint>& poly, bool nonzero, int xmin, int ymin, int xmax, int ymax) {
+    for (const CurvePoint& q : poly) {
+        if (fabs(q.x) > CLIP_GUARD || fabs(q.y) > CLIP_GUARD) {
+            clipPolygon(poly, CLIP_GUARD);
+            break;
+        }
+    }
+    vector<Point> v(poly.size());
+    for (size_t i = 0; i < poly.size(); i++) v[i] = Point((int)lround(poly[i].x), (int)lround(poly[i].y));
+    fillPolygon(sink, v, nonzero, xmin, ymin, xmax, ymax);
+}
+
+// Tramo de la cubeta (píxeles del mundo x0..x1 en la fila y) en la vista: cada píxel del
+// mundo es el cuadrado [x, x+1] x [y, y+1] y se pintan los píxeles de ventana cuyo centro
+// cae dentro. Al alejar, un tramo más estrecho que un píxel deja al menos el suyo.
+template <class Sink>
+void plotSpanInView(Sink& sink, int y, int x0, int x1, int xmin, int ymin, int xmax, int ymax) {
+    double left = projectX(x0), right = projectX(x1 + 1.0);
+    double bottom = projectY(y), top = projectY(y + 1.0);
+    int sx0 = (int)ceil(left - 0.5), sx1 = (int)ceil(right - 0.5) - 1;
+    int sy0 = (int)ceil(bottom - 0.5), sy1 = (int)ceil(top - 0.5) - 1;
+    if (sx0 > sx1) sx0 = sx1 = (int)floor((left + right) / 2);
+    if (sy0 > sy1) sy0 = sy1 = (int)floor((bottom + top) / 2);
+    sx0 = max(sx0, xmin);
+    sx1 = min(sx1, xmax);
+    if (sx0 > sx1) return;
+    for (int sy = max(sy0, ymin); sy <= min(sy1, ymax); sy++) sink.plotSpan(sy, sx0, sx1);
+}
+
+// Rasteriza una figura de tipo TYPE en coordenadas del mundo (el color y el grosor
+// los fija el destino). TYPE es constante: cada instancia contiene solo su algoritmo.
+template <class Sink, int TYPE>
+void rasterizeFigure(Sink& sink, const Figure& figure) {
+    const vector<Point>& p = figure.points;
+    if (TYPE == 0 && p.size() >= 2) drawLineDirect(sink, p[0], p[1]);
+    if (TYPE == 1 && p.size() >= 2) drawLineDDA(sink, p[0], p[1]);
+    if (TYPE == 2 && p.size() >= 2) drawCircleIncremental(sink, p[0], circleRadius(figure));
+    if (TYPE == 3 && p.size() >= 2) drawMidpointStencil<Sink, 3>(sink, p[0], circleRadius(figure), circleRadius(figure));
+    if (TYPE == 4 && p.size() >= 3) {
+        int rx = ellipseRx(figure), ry = ellipseRy(figure);
+        // Más allá del límite del punto medio en 64 bits solo se evalúa la zona exportada
+        if (rx > ELLIPSE_WIDE_LIMIT || ry > ELLIPSE_WIDE_LIMIT) {
+            drawConicClipped(sink, p[0].x, p[0].y, rx, ry, -CLIP_GUARD, -CLIP_GUARD, CLIP_GUARD, CLIP_GUARD);
+        } else {
+            drawMidpointStencil<Sink, 4>(sink, p[0], rx, ry);
+        }
+    }
+    if (TYPE == POLYLINE_TYPE) {
+        drawPath(sink, p.size(), [&](size_t i) { return CurvePoint{(double)p[i].x, (double)p[i].y}; });
+    }
+    if (TYPE == BEZIER_TYPE && p.size() >= 4) {
+        shared_ptr<const Flattening> flattening = flattenCurve(figure, flattenLevel(1.0));
+        const vector<CurvePoint>& v = flattening->points;
+        drawPath(sink, v.size(), [&](size_t i) { return v[i]; });
+    }
+    if (isPolygonType(TYPE) && p.size() >= 3) {
+        vector<CurvePoint> poly(p.size());
+        for (size_t i = 0; i < p.size(); i++) poly[i] = {(double)p[i].x, (double)p[i].y};
+        fillPolygonClipped(sink, poly, TYPE == POLYGON_NONZERO_TYPE, -CLIP_GUARD, -CLIP_GUARD, CLIP_GUARD, CLIP_GUARD);
+    }
+    if (TYPE == FLOOD_FILL_TYPE) {
+        for (size_t i = 1; i + 1 < p.size(); i += 2) sink.plotSpan(p[i].y, p[i].x, p[i + 1].x);
+    }
+    if (TYPE >= ROTATED_ELLIPSE_TYPE && TYPE <= ELLIPSE_ARC_TYPE && p.size() >= ellipseArcPoints(TYPE)) {
+        EllipseShape e = figureEllipseShape(figure);
+        CurvePoint from, to;
+        bool closed;
+        figureArcRange(figure, e, from, to, closed);
+        drawEllipseArc(sink, p[0].x, p[0].y, e, from, to, closed, -CLIP_GUARD, -CLIP_GUARD, CLIP_GUARD, CLIP_GUARD);
+    }
+}
+
+// Rasteriza una figura del mundo en la vista actual. Las que caen fuera de la ventana
+// se descartan, las menores de un píxel se reducen a un punto y las enormes se recortan,
+// así el coste sigue a lo visible y no al tamaño de la escena. Con la vista inicial el
+// resultado es idéntico a rasterizeFigure. Devuelve LOD_CULLED, LOD_POINT o LOD_FULL.
+template <class Sink, int TYPE>
+int rasterizeInView(Sink& sink, const Figure& figure, int thickness) {
+    const vector<Point>& p = figure.points;
+    double margin = thickness;
+    double xmin = -WIDTH/2 - margin, xmax = WIDTH/2 + margin;
+    double ymin = -HEIGHT/2 - margin, ymax = HEIGHT/2 + margin;
+
+    if (TYPE <= 1) { // Rectas
+        if (p.size() < 2) return LOD_CULLED;
+        double x0 = projectX(p[0].x), y0 = projectY(p[0].y);
+        double x1 = projectX(p[1].x), y1 = projectY(p[1].y);
+        if (max(x0, x1) < xmin || min(x0, x1) > xmax || max(y0, y1) < ymin || min(y0, y1) > ymax)
+            return LOD_CULLED;
+        if (fabs(x1 - x0) < 1 && fabs(y1 - y0) < 1) {
+            sink.plot((int)lround(x0), (int)lround(y0));
+            return LOD_POINT;
+        }
+        if (min(x0, x1) < -CLIP_GUARD || max(x0, x1) > CLIP_GUARD ||
+            min(y0, y1) < -CLIP_GUARD || max(y0, y1) > CLIP_GUARD) {
+            if (!clipSegment(x0, y0, x1, y1, xmin, ymin, xmax, ymax)) return LOD_CULLED;
+        }
+        Point a((int)lround(x0), (int)lround(y0)), b((int)lround(x1), (int)lround(y1));
+        if (TYPE == 0) drawLineDirect(sink, a, b);
+        else drawLineDDA(sink, a, b);
+        return LOD_FULL;
+    }
+
+    if (TYPE == POLYLINE_TYPE || TYPE == BEZIER_TYPE || isPolygonType(TYPE) || TYPE == FLOOD_FILL_TYPE) {
+        if (p.size() < (TYPE == POLYLINE_TYPE ? 2u : TYPE == BEZIER_TYPE ? 4u : 3u)) return LOD_CULLED;
+        // Los puntos de control encierran la curva (en la cubeta, la semilla y los tramos)
+        int left = p[0].x, right = p[0].x, bottom = p[0].y, top = p[0].y;
+        for (const Point& q : p) {
+            left = min(left, q.x); right = max(right, q.x);
+            bottom = min(bottom, q.y); top = max(top, q.y);
+        }
+        if (projectX(right) < xmin || projectX(left) > xmax || projectY(top) < ymin || projectY(bottom) > ymax)
+            return LOD_CULLED;
+        if ((right - left) * viewScale < 1 && (top - bottom) * viewScale < 1) {
+            sink.plot((int)lround(projectX(p[0].x)), (int)lround(projectY(p[0].y)));
+            return LOD_POINT;
+        }
+        if (TYPE == FLOOD_FILL_TYPE) {
+            int x0 = (int)floor(xmin), y0 = (int)floor(ymin), x1 = (int)ceil(xmax), y1 = (int)ceil(ymax);
+            for (size_t i = 1; i + 1 < p.size(); i += 2) plotSpanInView(sink, p[i].y, p[i].x, p[i + 1].x, x0, y0, x1, y1);
+        } else if (isPolygonType(TYPE)) {
+            vector<CurvePoint> poly(p.size());
+            for (size_t i = 0; i < p.size(); i++) poly[i] = {projectX(p[i].x), projectY(p[i].y)};
+            fillPolygonClipped(sink, poly, TYPE == POLYGON_NONZERO_TYPE, (int)floor(xmin), (int)floor(ymin),
+                               (int)ceil(xmax), (int)ceil(ymax));
+        } else if (TYPE == POLYLINE_TYPE) {
+            drawPathInView(sink, p.size(), [&](size_t i) { return CurvePoint{(double)p[i].x, (double)p[i].y}; },
+                           xmin, ymin, xmax, ymax);
+        } else {
+            shared_ptr<const Flattening> flattening = flattenCurve(figure, flattenLevel(viewScale));
+            const vector<CurvePoint>& v = flattening->points;
+            drawPathInView(sink, v.size(), [&](size_t i) { return v[i]; }, xmin, ymin, xmax, ymax);
+        }
+        return LOD_FULL;
+    }
+
+    if (TYPE >= ROTATED_ELLIPSE_TYPE && TYPE <= ELLIPSE_ARC_TYPE) {
+        if (p.size() < ellipseArcPoints(TYPE)) return LOD_CULLED;
+        EllipseShape e = figureEllipseShape(figure);
+        CurvePoint from, to;
+        bool closed;
+        figureArcRange(figure, e, from, to, closed);
+        e.a *= viewScale;
+        e.b *= viewScale;
+        return drawEllipseArc(sink, projectX(p[0].x), projectY(p[0].y), e, from, to, closed, xmin, ymin, xmax, ymax);
+    }
+
+    // Círculos y elipses
+    double rx, ry;
+    if (TYPE == 4) {
+        if (p.size() < 3 || ellipseRx(figure) == 0 || ellipseRy(figure) == 0) return LOD_CULLED;
+        rx = ellipseRx(figure) * viewScale;
+        ry = ellipseRy(figure) * viewScale;
+    } else {
+        if (p.size() < 2) return LOD_CULLED;
+        rx = ry = circleRadius(figure) * viewScale;
+    }
+    double cx = projectX(p[0].x), cy = projectY(p[0].y);
+    if (cx + rx < xmin || cx - rx > xmax || cy + ry < ymin || cy - ry > ymax) return LOD_CULLED;
+
+    if (rx < 0.5 && ry < 0.5) {
+        sink.plot((int)lround(cx), (int)lround(cy));
+        return LOD_POINT;
+    }
+
+    // La ventana (con margen para el grosor y el redondeo) cabe dentro de la
+    // figura sin tocar el trazo: no hay nada visible
+    bool inside = true;
+    for (double X : {xmin - 2, xmax + 2}) {
+        for (double Y : {ymin - 2, ymax + 2}) {
+            double u = (X - cx) / rx, v = (Y - cy) / ry;
+            if (u * u + v * v >= 1) inside = false;
+        }
+    }
+    if (inside) return LOD_CULLED;
+
+    if (rx > CLIP_GUARD || ry > CLIP_GUARD) {
+        drawConicClipped(sink, cx, cy, rx, ry, xmin, ymin, xmax, ymax);
+        return LOD_FULL;
+    }
+
+    Point center((int)lround(cx), (int)lround(cy));
+    int irx = max(1, (int)lround(rx)), iry = max(1, (int)lround(ry));
+    if (TYPE == 2) drawCircleIncremental(sink, center, (int)lround(rx));
+    else if (TYPE == 3) drawMidpointStencil<Sink, 3>(sink, center, (int)lround(rx), (int)lround(rx));
+    else drawMidpointStencil<Sink, 4>(sink, center, irx, iry);
+    return LOD_FULL;
+}
+
+// Tablas de rasterizadores por tipo, una por destino, construidas al compilar: elegir
+// la instancia es un acceso indexado y el bucle de cada una está especializado.
+template <class Sink>
+struct Rasterizers {
+    typedef void (*FigureFn)(Sink&, const Figure&);
+    typedef int (*ViewFn)(Sink&, const Figure&, int);
+    static const FigureFn world[FIGURE_TYPES];
+    static const ViewFn view[FIGURE_TYPES];
+};
+
+template <class Sink>
+const typename Rasterizers<Sink>::FigureFn Rasterizers<Sink>::world[FIGURE_TYPES] = {
+    rasterizeFigure<Sink, 0>, rasterizeFigure<Sink, 1>, rasterizeFigure<Sink, 2>,
+    rasterizeFigure<Sink, 3>, rasterizeFigure<Sink, 4>, rasterizeFigure<Sink, 5>,
+    rasterizeFigure<Sink, 6>, rasterizeFigure<Sink, 7>, rasterizeFigure<Sink, 8>,
+    rasterizeFigure<Sink, 9>, rasterizeFigure<Sink, 10>, rasterizeFigure<Sink, 11>,
+    rasterizeFigure<Sink, 12>
+};
+
+template <class Sink>
+const typename Rasterizers<Sink>::ViewFn Rasterizers<Sink>::view[FIGURE_TYPES] = {
+    rasterizeInView<Sink, 0>, rasterizeInView<Sink, 1>, rasterizeInView<Sink, 2>,
+    rasterizeInView<Sink, 3>, rasterizeInView<Sink, 4>, rasterizeInView<Sink, 5>,
+    rasterizeInView<Sink, 6>, rasterizeInView<Sink, 7>, rasterizeInView<Sink, 8>,
+    rasterizeInView<Sink, 9>, rasterizeInView<Sink, 10>, rasterizeInView<Sink, 11>,
+    rasterizeInView<Sink, 12>
+};
+
+// Rasteriza una figura en coordenadas del mundo, sin vista (exportaciones)
+template <class Sink>
+void drawFigure(Sink& sink, const Figure& figure) {
+    if (figure.type >= 0 && figure.type < FIGURE_TYPES) Rasterizers<Sink>::world[figure.type](sink, figure);
+}
+
+// Rasteriza una figura en la vista actual con el grosor dado (en píxeles)
+template <class Sink>
+int drawFigureInView(Sink& sink, const Figure& figure, int thickness) {
+    if (figure.type < 0 || figure.type >= FIGURE_TYPES) return LOD_CULLED;
+    return Rasterizers<Sink>::view[figure.type](sink, figure, thickness);
+}
+
+// Selección de figuras. Cada figura se registra en las celdas de una rejilla hash que
+// quedan a menos de su tolerancia de selección, así un clic solo evalúa las figuras
+// de la celda bajo el cursor con la distancia exacta a la recta, círculo o elipse.
+// Las celdas guardan slots de la lista, que no cambian al borrar otras figuras: borrar
+// o restaurar una figura solo toca sus propias celdas.
+const int SELECT_TOOL = 100;  // fuera del rango de tipos de figura
+const int PICK_CELL = 32;            // lado de la celda en píxeles
+const int PICK_TOLERANCE = 5;        // distancia máxima al trazo, además del grosor
+const long long PICK_MAX_CELLS = 4096;  // figuras más grandes van a la lista general
+const size_t VIEW_INDEX_MIN = 4096;     // escenas menores se recorren enteras al dibujar
+
+struct PickIndex {
+    unordered_map<long long, vector<int>> cells;
+    vector<int> oversized;
+    size_t count = 0;      // slots indexados: siempre un prefijo de los de figures
+    int maxTolerance = 0;  // cotas superiores: no bajan al borrar
+    int maxThickness = 0;
+    vector<long long> scratch;
+};
+
+PickIndex pickIndex;
+int selectedFigure = -1;
+
+double segmentDistance(double px, double py, CurvePoint a, CurvePoint b) {
+    double dx = b.x - a.x, dy = b.y - a.y;
+    double len2 = dx * dx + dy * dy;
+    double t = len2 > 0 ? ((px - a.x) * dx + (py - a.y) * dy) / len2 : 0;
+    t = max(0.0, min(1.0, t));
+    return hypot(px - (a.x + t * dx), py - (a.y + t * dy));
+}
+
+double segmentDistance(double px, double py, Point a, Point b) {
+    return segmentDistance(px, py, CurvePoint{(double)a.x, (double)a.y}, CurvePoint{(double)b.x, (double)b.y});
+}
+
+// Distancia a una elipse alineada con los ejes centrada en el origen: iteración sobre
+// el punto más cercano en el primer cuadrante (converge en pocas vueltas).
+double ellipseDistance(double px, double py, double a, double b) {
+    px = fabs(px);
+    py = fabs(py);
+    if (a == 0) return segmentDistance(px, py, Point(0, 0), Point(0, (int)b));
+    if (b == 0) return segmentDistance(px, py, Point(0, 0), Point((int)a, 0));
+
+    double tx = M_SQRT1_2, ty = M_SQRT1_2;
+    for (int i = 0; i < 4; i++) {
+        double x = a * tx, y = b * ty;
+        double ex = (a * a - b * b) * tx * tx * tx / a;
+        double ey = (b * b - a * a) * ty * ty * ty / b;
+        double r = hypot(x - ex, y - ey);
+        double q = hypot(px - ex, py - ey);
+        if (q == 0) break;
+        tx = max(0.0, min(1.0, ((px - ex) * r / q + ex) / a));
+        ty = max(0.0, min(1.0, ((py - ey) * r / q + ey) / b));
+        double t = hypot(tx, ty);
+        tx /= t;
+        ty /= t;
+    }
+    return hypot(a * tx - px, b * ty - py);
+}
+
+// Vueltas del contorno cerrado alrededor de (px, py), con la misma regla de medio
+// abierto que el relleno: cuenta los bordes que cruzan la fila a su derecha
+int polygonWinding(const vector<Point>& p, double px, double py) {
+    int winding = 0;
+    for (size_t i = 0; i < p.size(); i++) {
+        const Point& a = p[i];
+        const Point& b = p[i + 1 < p.size() ? i + 1 : 0];
+        if ((a.y <= py) == (b.y <= py)) continue;
+        double x = a.x + (py - a.y) * (b.x - a.x) / (double)(b.y - a.y);
+        if (x > px) winding += a.y < b.y ? 1 : -1;
+    }
+    return winding;
+}
+
+double figureDistance(const Figure& figure, double px, double py) {
+    const vector<Point>& p = figure.points;
+    switch (figure.type) {
+        case 0: case 1:
+            if (p.size() >= 2) return segmentDistance(px, py, p[0], p[1]);
+            break;
+        case 2: case 3:
+            if (p.size() >= 2) return fabs(hypot(px - p[0].x, py - p[0].y) - circleRadius(figure));
+            break;
+        case 4:
+            if (p.size() >= 3) return ellipseDistance(px - p[0].x, py - p[0].y, ellipseRx(figure), ellipseRy(figure));
+            break;
+        case POLYLINE_TYPE: {
+            double best = 1e30;
+            for (size_t i = 0; i + 1 < p.size(); i++) best = min(best, segmentDistance(px, py, p[i], p[i + 1]));
+            return best;
+        }
+        case BEZIER_TYPE:
+            if (p.size() >= 4) {
+                shared_ptr<const Flattening> flattening = flattenCurve(figure, flattenLevel(1.0));
+                const vector<CurvePoint>& v = flattening->points;
+                double best = 1e30;
+                for (size_t i = 0; i + 1 < v.size(); i++) best = min(best, segmentDistance(px, py, v[i], v[i + 1]));
+                return best;
+            }
+            break;
+        case POLYGON_EVEN_ODD_TYPE: case POLYGON_NONZERO_TYPE:
+            if (p.size() >= 3) {
+                // Dentro del relleno la distancia es 0; fuera, la del contorno
+                int winding = polygonWinding(p, px, py);
+                if (figure.type == POLYGON_NONZERO_TYPE ? winding != 0 : (winding & 1) != 0) return 0;
+                double best = 1e30;
+                for (size_t i = 0; i < p.size(); i++)
+                    best = min(best, segmentDistance(px, py, p[i], p[i + 1 < p.size() ? i + 1 : 0]));
+                return best;
+            }
+            break;
+        case ROTATED_ELLIPSE_TYPE: case CIRCLE_ARC_TYPE: case ELLIPSE_ARC_TYPE:
+            if (p.size() >= ellipseArcPoints(figure.type)) {
+                EllipseShape e = figureEllipseShape(figure);
+                CurvePoint from, to;
+                bool closed;
+                figureArcRange(figure, e, from, to, closed);
+                double dx = px - p[0].x, dy = py - p[0].y;
+                if (inArc(from, to, closed, dx, dy)) {
+                    return ellipseDistance(dx * e.cosT + dy * e.sinT, dy * e.cosT - dx * e.sinT, e.a, e.b);
+                }
+                // Fuera del ángulo del arco, el extremo más cercano
+                Conic k = ellipseConic(e);
+                CurvePoint s = conicPointInDirection(k, from), t = conicPointInDirection(k, to);
+                return min(hypot(dx - s.x, dy - s.y), hypot(dx - t.x, dy - t.y));
+            }
+            break;
+        case FLOOD_FILL_TYPE: {
+            if (p.size() < 3) break;
+            // Solo se selecciona haciendo clic dentro: tramos ordenados por fila y columna
+            int x = (int)floor(px), y = (int)floor(py);
+            size_t lo = 0, hi = (p.size() - 1) / 2;  // primer tramo con (fila, x0) > (y, x)
+            while (lo < hi) {
+                size_t mid = (lo + hi) / 2;
+                const Point& q = p[1 + 2 * mid];
+                if (q.y < y || (q.y == y && q.x <= x)) lo = mid + 1;
+                else hi = mid;
+            }
+            if (lo > 0 && p[2 * lo - 1].y == y && p[2 * lo].x >= x) return 0;
+            break;
+        }
+    }
+    return 1e30;
+}
+
+int pickTolerance(const Figure& figure) {
+    return PICK_TOLERANCE + figure.thickness / 2;
+}
+
+long long pickCellKey(int cx, int cy) {
+    return ((long long)cx << 32) ^ (unsigned int)cy;
+}
+
+int pickCellOf(int v) {
+    return (int)floor((double)v / PICK_CELL);
+}
+
+// Celdas donde la figura es seleccionable. Devuelve false si ocupa demasiadas.
+bool pickCells(const Figure& figure, vector<long long>& out) {
+    out.clear();
+    const vector<Point>& p = figure.points;
+    if (p.empty()) return true;
+
+    if (figure.type == FLOOD_FILL_TYPE) {
+        // Las celdas que tocan los tramos: la cubeta solo se selecciona haciendo clic dentro
+        for (size_t i = 1; i + 1 < p.size(); i += 2) {
+            int cy = pickCellOf(p[i].y);
+            for (int cx = pickCellOf(p[i].x); cx <= pickCellOf(p[i + 1].x); cx++) out.push_back(pickCellKey(cx, cy));
+        }
+        sort(out.begin(), out.end());
+        out.erase(unique(out.begin(), out.end()), out.end());
+        return (long long)out.size() <= PICK_MAX_CELLS;
+    }
+
+    int x0, y0, x1, y1;
+    if ((figure.type == 2 || figure.type == 3) && p.size() >= 2) {
+        int r = circleRadius(figure);
+        x0 = p[0].x - r; x1 = p[0].x + r; y0 = p[0].y - r; y1 = p[0].y + r;
+    } else if (figure.type == 4 && p.size() >= 3) {
+        int rx = ellipseRx(figure), ry = ellipseRy(figure);
+        x0 = p[0].x - rx; x1 = p[0].x + rx; y0 = p[0].y - ry; y1 = p[0].y + ry;
+    } else if (figure.type >= ROTATED_ELLIPSE_TYPE && figure.type <= ELLIPSE_ARC_TYPE &&
+               p.size() >= ellipseArcPoints(figure.type)) {
+        // La caja de la elipse entera también vale para sus arcos
+        EllipseShape e = figureEllipseShape(figure);
+        int hx = (int)ceil(hypot(e.a * e.cosT, e.b * e.sinT)), hy = (int)ceil(hypot(e.a * e.sinT, e.b * e.cosT));
+        x0 = p[0].x - hx; x1 = p[0].x + hx; y0 = p[0].y - hy; y1 = p[0].y + hy;
+    } else {
+        x0 = x1 = p[0].x; y0 = y1 = p[0].y;
+        for (const auto& q : p) {
+            x0 = min(x0, q.x); x1 = max(x1, q.x);
+            y0 = min(y0, q.y); y1 = max(y1, q.y);
+        }
+    }
+
+    int tol = pickTolerance(figure);
+    int cx0 = pickCellOf(x0 - tol), cx1 = pickCellOf(x1 + tol);
+    int cy0 = pickCellOf(y0 - tol), cy1 = pickCellOf(y1 + tol);
+    if ((long long)(cx1 - cx0 + 1) * (cy1 - cy0 + 1) > PICK_MAX_CELLS) return false;
+
+    // Una celda sirve si su centro está a menos de tolerancia + media diagonal del trazo.
+    // En elipses, |f - 1| * min(rx, ry) con f = sqrt((x/rx)^2 + (y/ry)^2) acota por debajo
+    // la distancia y descarta sin iterar casi todas las celdas lejos del trazo.
+    double reach = tol + PICK_CELL * M_SQRT1_2;
+    bool ellipse = figure.type == 4 && p.size() >= 3 && ellipseRx(figure) > 0 && ellipseRy(figure) > 0;
+    for (int cy = cy0; cy <= cy1; cy++) {
+        for (int cx = cx0; cx <= cx1; cx++) {
+            double centerX = (cx + 0.5) * PICK_CELL, centerY = (cy + 0.5) * PICK_CELL;
+            if (ellipse) {
+                double rx = ellipseRx(figure), ry = ellipseRy(figure);
+                double f = hypot((centerX - p[0].x) / rx, (centerY - p[0].y) / ry);
+                if (fabs(f - 1) * min(rx, ry) > reach) continue;
+            }
+            if (figureDistance(figure, centerX, centerY) <= reach) out.push_back(pickCellKey(cx, cy));
+        }
+    }
+    return true;
+}
+
+void pickInsert(size_t slot) {
+    const Figure& figure = figures.atSlot(slot);
+    pickIndex.maxTolerance = max(pickIndex.maxTolerance, pickTolerance(figure));
+    pickIndex.maxThickness = max(pickIndex.maxThickness, figure.thickness);
+    if (!pickCells(figure, pickIndex.scratch)) {
+        pickIndex.oversized.push_back(slot);
+        return;
+    }
+    for (long long key : pickIndex.scratch) pickIndex.cells[key].push_back(slot);
+}
+
+// Llamar antes de borrar la figura del slot: quita sus entradas de las celdas
+void pickErase(size_t slot) {
+    if (slot >= pickIndex.count) return;
+    auto drop = [slot](vector<int>& ids) {
+        ids.erase(lower_bound(ids.begin(), ids.end(), (int)slot));
+    };
+    if (!pickCells(figures.atSlot(slot), pickIndex.scratch)) {
+        drop(pickIndex.oversized);
+        return;
+    }
+    for (long long key : pickIndex.scratch) {
+        auto it = pickIndex.cells.find(key);
+        drop(it->second);
+        if (it->second.empty()) pickIndex.cells.erase(it);
+    }
+}
+
+// Llamar después de deshacer el borrado: la figura vuelve a su slot
+void pickRestore(size_t slot) {
+    if (slot >= pickIndex.count) return;
+    const Figure& figure = figures.atSlot(slot);
+    pickIndex.maxTolerance = max(pickIndex.maxTolerance, pickTolerance(figure));
+    pickIndex.maxThickness = max(pickIndex.maxThickness, figure.thickness);
+    auto add = [slot](vector<int>& ids) {
+        ids.insert(upper_bound(ids.begin(), ids.end(), (int)slot), (int)slot);
+    };
+    if (!pickCells(figure, pickIndex.scratch)) {
+        add(pickIndex.oversized);
+        return;
+    }
+    for (long long key : pickIndex.scratch) add(pickIndex.cells[key]);
+}
+
+// Llamar antes de quitar la última figura: su slot es el mayor, así que sus entradas
+// son las últimas de cada celda, y los huecos que la siguen se van con ella
+void pickRemoveLast() {
+    if (figures.empty()) return;
+    size_t slot = figures.slotOf(figures.size() - 1);
+    if (slot < pickIndex.count) {
+        if (!pickCells(figures.atSlot(slot), pickIndex.scratch)) {
+            pickIndex.oversized.pop_back();
+        } else {
+            for (long long key : pickIndex.scratch) {
+                auto it = pickIndex.cells.find(key);
+                it->second.pop_back();
+                if (it->second.empty()) pickIndex.cells.erase(it);
+            }
+        }
+    }
+    pickIndex.count = min(pickIndex.count, slot);
+}
+
+void pickSync() {
+    for (; pickIndex.count < figures.slotCount(); pickIndex.count++) {
+        if (figures.live(pickIndex.count)) pickInsert(pickIndex.count);
+    }
+}
+
+// Figura más cercana al punto dentro de su tolerancia, o -1. La tolerancia es en
+// píxeles de ventana: con la vista alejada (scale < 1) abarca más mundo y se miran
+// también las celdas vecinas.
+int pickFigure(Point p, double scale = 1.0) {
+    TRACE_SCOPE("pickFigure");
+    pickSync();
+
+    // Se comparan slots, que siguen el orden de dibujo; al final se pasa a posición
+    int best = -1;
+    double bestDist = 1e30;
+    auto test = [&](int id) {
+        const Figure& figure = figures.atSlot(id);
+        double d = figureDistance(figure, p.x, p.y);
+        if (d <= pickTolerance(figure) / scale && (d < bestDist || (d == bestDist && id > best))) {
+            best = id;
+            bestDist = d;
+        }
+    };
+
+    int reach = scale < 1 ? (int)ceil(pickIndex.maxTolerance / scale / PICK_CELL) : 0;
+    int cx = pickCellOf(p.x), cy = pickCellOf(p.y);
+    if ((long long)(2 * reach + 1) * (2 * reach + 1) > (long long)pickIndex.cells.size()) {
+        for (int id = 0; id < (int)figures.slotCount(); id++) {
+            if (figures.live(id)) test(id);
+        }
+        return best < 0 ? -1 : (int)figures.positionOf(best);
+    }
+    for (int y = cy - reach; y <= cy + reach; y++) {
+        for (int x = cx - reach; x <= cx + reach; x++) {
+            auto it = pickIndex.cells.find(pickCellKey(x, y));
+            if (it != pickIndex.cells.end()) {
+                for (int id : it->second) test(id);
+            }
+        }
+    }
+    for (int id : pickIndex.oversized) test(id);
+    return best < 0 ? -1 : (int)figures.positionOf(best);
+}
+
+// Slots de las figuras que pueden dibujar algo en el rectángulo del mundo, en orden de
+// dibujo. El trazo sobresale hasta la tolerancia más el grosor, en píxeles de ventana:
+// a escala menor que 1 eso abarca más mundo. El píxel de más cubre las figuras reducidas
+// a un punto. Devuelve false en escenas pequeñas o si el rectángulo abarca tantas celdas
+// que conviene recorrer la lista entera.
+bool pickCandidates(double x0, double y0, double x1, double y1, double scale, vector<int>& out) {
+    if (figures.size() < VIEW_INDEX_MIN) return false;
+    pickSync();
+
+    double margin = (pickIndex.maxTolerance + pickIndex.maxThickness + 1) / scale;
+    int cx0 = pickCellOf((int)floor(x0 - margin)), cx1 = pickCellOf((int)ceil(x1 + margin));
+    int cy0 = pickCellOf((int)floor(y0 - margin)), cy1 = pickCellOf((int)ceil(y1 + margin));
+    if ((long long)(cx1 - cx0 + 1) * (cy1 - cy0 + 1) * 4 > (long long)pickIndex.cells.size()) return false;
+
+    out.assign(pickIndex.oversized.begin(), pickIndex.oversized.end());
+    for (int cy = cy0; cy <= cy1; cy++) {
+        for (int cx = cx0; cx <= cx1; cx++) {
+            auto it = pickIndex.cells.find(pickCellKey(cx, cy));
+            if (it != pickIndex.cells.end()) out.insert(out.end(), it->second.begin(), it->second.end());
+        }
+    }
+    sort(out.begin(), out.end());
+    out.erase(unique(out.begin(), out.end()), out.end());
+    return true;
+}
+
+// Cubeta: rellena con el color actual la región del mundo bajo el punto, sin cuadrícula
+// ni ejes y a escala 1, y la guarda como figura con sus tramos. Así se repite igual al
+// dibujar con cualquier vista, exportar o cargar la escena. El lienzo es un mosaico de
+// ventanas alineadas a una rejilla fija del mundo (la (i, j) es la vista centrada en
+// (i*WIDTH, j*HEIGHT)) y cada una se dibuja aparte con las figuras que la tocan según el
+// índice de selección. El lienzo se conserva entre clics: sigue valiendo mientras la
+// escena solo cambie por rellenos añadidos, que se pintan encima. Si la región toca el
+// borde, el lienzo se amplía alrededor de la semilla copiando las ventanas que ya tenía
+// y dibujando solo las nuevas; pasado FLOOD_MAX_RADIUS la región abierta se corta en el
+// borde y se avisa.
+const int FLOOD_MAX_RADIUS = 2;  // ventanas a cada lado de la de la semilla
+Framebuffer floodCanvas, floodSpare, floodTile;  // se reutilizan entre clics
+int floodCenterX = 0, floodCenterY = 0;  // ventana central del lienzo
+int floodRadius = -1;                    // ventanas a cada lado; -1: no hay lienzo
+unsigned long long floodVersion = 0;     // sceneVersion de lo dibujado en el lienzo
+vector<StencilRun> floodSpans;
+vector<int> floodCandidates;
+
+int floodTileOf(int v, int size) {
+    return (int)floor((v + size / 2) / (double)size);
+}
+
+// Copia una ventana de WIDTH x HEIGHT entre imágenes
+void copyFloodTile(Framebuffer& dst, int dstCol, int dstRow, const Framebuffer& src, int srcCol, int srcRow) {
+    for (int y = 0; y < HEIGHT; y++) {
+        memcpy(&dst.rgb[3 * ((size_t)(dstRow + y) * dst.width + dstCol)],
+               &src.rgb[3 * ((size_t)(srcRow + y) * src.width + srcCol)], 3 * WIDTH);
+    }
+}
+
+// Dibuja la ventana (i, j) del mundo en floodTile
+void renderFloodTile(int i, int j) {
+    clearFramebuffer(floodTile, WIDTH, HEIGHT);
+    double savedX = viewX, savedY = viewY, savedScale = viewScale;
+    viewX = i * WIDTH;
+    viewY = j * HEIGHT;
+    viewScale = 1;
+    auto draw = [](const Figure& figure) {
+        for (int c = 0; c < 3; c++) floodTile.color[c] = (unsigned char)lround(figure.color[c] * 255);
+        floodTile.thickness = figure.thickness;
+        if (figure.thickness == 1) {
+            FramebufferSink<true> sink(floodTile);
+            drawFigureInView(sink, figure, 1);
+        } else {
+            FramebufferSink<false> sink(floodTile);
+            drawFigureInView(sink, figure, figure.thickness);
+        }
+    };
+    if (pickCandidates(viewX - WIDTH/2, viewY - HEIGHT/2, viewX + WIDTH/2, viewY + HEIGHT/2, 1, floodCandidates)) {
+        for (int id : floodCandidates) draw(figures.atSlot(id));
+    } else {
+        for (const auto& figure : figures) draw(figure);
+    }
+    viewX = savedX;
+    viewY = savedY;
+    viewScale = savedScale;
+}
+
+// Lienzo con las ventanas a radius o menos de (centerX, centerY). Las que ya estaban en
+// el lienzo anterior y la escena no ha cambiado se copian; el resto se dibuja.
+void frameFloodCanvas(int centerX, int centerY, int radius) {
+    bool keep = floodRadius >= 0 && floodVersion == sceneVersion;
+    int tiles = 2 * radius + 1;
+    floodSpare.width = tiles * WIDTH;  // cada ventana se copia o se dibuja entera: no hace falta borrar
+    floodSpare.height = tiles * HEIGHT;
+    floodSpare.rgb.resize(3 * (size_t)floodSpare.width * floodSpare.height);
+    for (int j = centerY - radius; j <= centerY + radius; j++) {
+        for (int i = centerX - radius; i <= centerX + radius; i++) {
+            int col = (i - centerX + radius) * WIDTH, row = (radius - (j - centerY)) * HEIGHT;
+            if (keep && abs(i - floodCenterX) <= floodRadius && abs(j - floodCenterY) <= floodRadius) {
+                copyFloodTile(floodSpare, col, row, floodCanvas,
+                              (i - floodCenterX + floodRadius) * WIDTH, (floodRadius - (j - floodCenterY)) * HEIGHT);
+            } else {
+                renderFloodTile(i, j);
+                copyFloodTile(floodSpare, col, row, floodTile, 0, 0);
+            }
+        }
+    }
+    swap(floodCanvas, floodSpare);
+    // (0, 0) del mundo en el lienzo, como en una vista a escala 1
+    floodCanvas.originX = (radius - centerX) * WIDTH + WIDTH/2;
+    floodCanvas.originY = (radius + centerY) * HEIGHT + HEIGHT/2;
+    floodCenterX = centerX;
+    floodCenterY = centerY;
+    floodRadius = radius;
+    floodVersion = sceneVersion;
+}
+
+bool buildFloodFill(Point seed, Figure& out) {
+    TRACE_SCOPE("buildFloodFill");
+    int tileX = floodTileOf(seed.x, WIDTH), tileY = floodTileOf(seed.y, HEIGHT);
+    if (floodRadius < 0 || floodVersion != sceneVersion ||
+        abs(tileX - floodCenterX) > floodRadius || abs(tileY - floodCenterY) > floodRadius) {
+        frameFloodCanvas(tileX, tileY, 0);
+    }
+    // floodFillSpans marca la región; al terminar el lienzo vuelve a ser la escena y el
+    // relleno se pinta al añadirlo (floodCanvasAppend)
+    unsigned char old[3];
+    auto unmark = [&old]() {
+        for (const StencilRun& span : floodSpans)
+            fillRow(&floodCanvas.rgb[3 * ((size_t)span.y * floodCanvas.width + span.x0)], span.x1 - span.x0 + 1, old);
+    };
+    for (;;) {
+        int seedCol = seed.x + floodCanvas.originX, seedRow = floodCanvas.originY - 1 - seed.y;
+        memcpy(old, &floodCanvas.rgb[3 * ((size_t)seedRow * floodCanvas.width + seedCol)], 3);
+        floodFillSpans(floodCanvas, seedCol, seedRow, floodSpans);
+        bool open = false;
+        for (const StencilRun& span : floodSpans) {
+            if (span.y == 0 || span.y == floodCanvas.height - 1 || span.x0 == 0 || span.x1 == floodCanvas.width - 1) {
+                open = true;
+                break;
+            }
+        }
+        if (!open) break;
+        bool centered = floodCenterX == tileX && floodCenterY == tileY;
+        if (centered && floodRadius == FLOOD_MAX_RADIUS) {
+            cout << "Region abierta: el relleno se corta a " << floodCanvas.width << "x" << floodCanvas.height
+                 << " pixeles alrededor del clic" << endl;
+            break;
+        }
+        // La región se escapa: el lienzo se centra en la semilla con una ventana más por lado
+        unmark();
+        frameFloodCanvas(tileX, tileY, min(floodRadius + 1, FLOOD_MAX_RADIUS));
+    }
+    unmark();
+    if (floodSpans.empty()) return false;
+
+    out.type = FLOOD_FILL_TYPE;
+    out.points.clear();
+    out.points.reserve(1 + 2 * floodSpans.size());
+    out.points.push_back(seed);
+    // Ordenados de abajo arriba y de izquierda a derecha para buscarlos al seleccionar
+    sort(floodSpans.begin(), floodSpans.end(), [](const StencilRun& a, const StencilRun& b) {
+        return a.y != b.y ? a.y > b.y : a.x0 < b.x0;
+    });
+    for (const StencilRun& span : floodSpans) {
+        int y = floodCanvas.originY - 1 - span.y;
+        out.points.push_back(Point(span.x0 - floodCanvas.originX, y));
+        out.points.push_back(Point(span.x1 - floodCanvas.originX, y));
+    }
+    return true;
+}
+
+// Un relleno recién añadido queda encima de todo: se pinta en el lienzo, que sigue
+// valiendo para la escena nueva. Llamar justo después de añadirlo.
+void floodCanvasAppend(const Figure& fill, unsigned long long versionBefore) {
+    if (floodRadius < 0 || floodVersion != versionBefore) return;
+    unsigned char color[3];
+    for (int c = 0; c < 3; c++) color[c] = (unsigned char)lround(fill.color[c] * 255);
+    const vector<Point>& p = fill.points;
+    for (size_t i = 1; i + 1 < p.size(); i += 2) {
+        int row = floodCanvas.originY - 1 - p[i].y;
+        int x0 = max(p[i].x + floodCanvas.originX, 0), x1 = min(p[i + 1].x + floodCanvas.originX, floodCanvas.width - 1);
+        if (row < 0 || row >= floodCanvas.height || x0 > x1) continue;
+        fillRow(&floodCanvas.rgb[3 * ((size_t)row * floodCanvas.width + x0)], x1 - x0 + 1, color);
+    }
+    floodVersion = sceneVersion;
+}
+
+// Resalta la figura seleccionada en la capa superior
+void drawSelection() {
+    if (selectedFigure < 0 || selectedFigure >= (int)figures.size()) return;
+    const Figure& figure = figures[selectedFigure];
+    glColor3f(1.0f, 0.6f, 0.0f);
+    perf.glCalls++;
+    GLSink sink(figure.thickness + 2);
+    drawFigureInView(sink, figure, figure.thickness + 2);
+}
+
+// Callbacks de OpenGL
+void invalidateScene() {
+    sceneDirty = true;
+    sceneVersion++;
+}
+
+double elapsedMs(chrono::steady_clock::time_point since) {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - since).count();
+}
+
+// Con la vista acercada sobre una escena grande, el índice de selección da las figuras
+// cercanas a la ventana sin recorrer toda la lista: sus slots, en orden de dibujo.
+// Devuelve false si conviene recorrerla entera.
+bool visibleCandidates(vector<int>& out) {
+    return pickCandidates(viewX - (WIDTH/2) / viewScale, viewY - (HEIGHT/2) / viewScale,
+                          viewX + (WIDTH/2) / viewScale, viewY + (HEIGHT/2) / viewScale, viewScale, out);
+}
+
+void drawScene() {
+    TRACE_SCOPE("drawScene");
+    auto start = chrono::steady_clock::now();
+    glClear(GL_COLOR_BUFFER_BIT);
+    perf.glCalls++;
+
+    if (showGrid) drawGrid();
+    if (showAxes) drawAxes();
+
+    // Dibujar todas las figuras
+    for (int t = 0; t < FIGURE_TYPES; t++) {
+        perf.rasterMs[t] = 0;
+        perf.pixels[t] = 0;
+    }
+    perf.culledFigures = 0;
+    perf.pointFigures = 0;
+    perf.repeatedPixels = 0;
+    auto drawOne = [](const Figure& figure) {
+        glColor3fv(figure.color);
+        perf.glCalls++;
+        auto figureStart = chrono::steady_clock::now();
+        long long pixels;
+        int lod;
+        {
+            GLSink sink(figure.thickness);
+            lod = drawFigureInView(sink, figure, figure.thickness);
+            pixels = sink.pixels;
+            perf.repeatedPixels += sink.overdraw.total();
+            overdrawTotal.add(sink.overdraw);
+        }
+
+        if (lod == LOD_CULLED) perf.culledFigures++;
+        else if (lod == LOD_POINT) perf.pointFigures++;
+        if (figure.type >= 0 && figure.type < FIGURE_TYPES) {
+            perf.rasterMs[figure.type] += elapsedMs(figureStart);
+            perf.pixels[figure.type] += pixels;
+        }
+    };
+
+    static vector<int> candidates;
+    if (visibleCandidates(candidates)) {
+        perf.culledFigures = figures.size() - candidates.size();
+        for (int id : candidates) drawOne(figures.atSlot(id));
+    } else {
+        for (const auto& figure : figures) drawOne(figure);
+    }
+    perf.figureCount = figures.size();
+    perf.sceneMs = elapsedMs(start);
+}
+
+// Copia la escena recién rasterizada a la textura de caché
+void cacheScene() {
+    TRACE_SCOPE("cacheScene");
+    glBindTexture(GL_TEXTURE_2D, sceneTexture);
+    glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, WIDTH, HEIGHT);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    perf.glCalls += 3;
+}
+
+void drawCachedScene() {
+    glEnable(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, sceneTexture);
+    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+    glBegin(GL_QUADS);
+    glTexCoord2f(0, 0); glVertex2i(-WIDTH/2, -HEIGHT/2);
+    glTexCoord2f(1, 0); glVertex2i(WIDTH/2, -HEIGHT/2);
+    glTexCoord2f(1, 1); glVertex2i(WIDTH/2, HEIGHT/2);
+    glTexCoord2f(0, 1); glVertex2i(-WIDTH/2, HEIGHT/2);
+    glEnd();
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glDisable(GL_TEXTURE_2D);
+    perf.glCalls += 15;  // 3 de estado, glBegin, 4 coordenadas y 4 vértices, glEnd y 2 de estado
+}
+
+// Vista previa de la figura en construcción con el punto bajo el cursor
+void drawPreview() {
+    Figure preview;
+    preview.type = currentTool;
+    preview.thickness = currentThickness;
+    preview.points = tempPoints;
+
+    Point cursor = screenToWorld(mouseX - WIDTH/2, HEIGHT/2 - mouseY);
+    preview.points.push_back(cursor);
+    if (currentTool == 4 && tempPoints.size() == 1) {
+        // Con solo el centro, el cursor da ambos radios
+        preview.points[1] = Point(cursor.x, tempPoints[0].y);
+        preview.points.push_back(Point(tempPoints[0].x, cursor.y));
+    }
+    if ((currentTool == ROTATED_ELLIPSE_TYPE || currentTool == ELLIPSE_ARC_TYPE) && tempPoints.size() == 1) {
+        // Con solo el centro, el cursor da el semieje a y se muestra la circunferencia
+        Point c = tempPoints[0];
+        preview.type = ROTATED_ELLIPSE_TYPE;
+        preview.points.push_back(Point(c.x - (cursor.y - c.y), c.y + (cursor.x - c.x)));
+    } else if (currentTool == ELLIPSE_ARC_TYPE && tempPoints.size() <= 3) {
+        // Hasta elegir el inicio del arco se muestra la elipse entera
+        preview.type = ROTATED_ELLIPSE_TYPE;
+        preview.points.resize(3);
+    } else if (currentTool == CIRCLE_ARC_TYPE && tempPoints.size() == 1) {
+        preview.type = 3;
+    }
+
+    if (currentTool == BEZIER_TYPE || isPolygonType(currentTool)) {
+        // Polígono de control o contorno en gris: la curva solo muestra los tramos
+        // completos y el relleno necesita al menos tres vértices
+        Figure control = preview;
+        control.type = POLYLINE_TYPE;
+        if (isPolygonType(currentTool)) control.points.push_back(control.points[0]);
+        glColor3f(0.7f, 0.7f, 0.7f);
+        perf.glCalls++;
+        GLSink sink(1);
+        drawFigureInView(sink, control, 1);
+    }
+
+    glColor3fv(currentColor);
+    perf.glCalls++;
+    GLSink sink(currentThickness);
+    drawFigureInView(sink, preview, currentThickness);
+}
+
+// Planificador de frames: los eventos piden redibujar con requestRedisplay() y las
+// peticiones se agrupan en un solo frame por intervalo de refresco. Si el último frame
+// es más antiguo que el intervalo, se dibuja en cuanto GLUT termina de procesar la
+// entrada pendiente, así una acción aislada no espera y solo las ráfagas se agrupan.
+const int FRAME_INTERVAL_MS = 16;  // ~60 Hz
+bool redisplayPending = false;
+chrono::steady_clock::time_point lastFrameTime;
+Point shownCursor;  // punto del mundo bajo el cursor en el último frame
+
+void frameTimer(int) {
+    if (redisplayPending) glutPostRedisplay();
+}
+
+void requestRedisplay() {
+    perf.redisplayRequests++;
+    if (redisplayPending) return;
+    redisplayPending = true;
+    int wait = FRAME_INTERVAL_MS - (int)elapsedMs(lastFrameTime);
+    if (wait <= 0) glutPostRedisplay();
+    else glutTimerFunc(wait, frameTimer, 0);
+}
+
+// El cursor solo cambia la imagen si se ven las coordenadas o la vista previa y
+// además cae en otro punto del mundo (con zoom varios píxeles comparten punto)
+bool cursorChangesFrame() {
+    if (!showCoords && tempPoints.empty()) return false;
+    Point p = screenToWorld(mouseX - WIDTH/2, HEIGHT/2 - mouseY);
+    return p.x != shownCursor.x || p.y != shownCursor.y;
+}
+
+void display() {
+    TRACE_SCOPE("display");
+    auto start = chrono::steady_clock::now();
+    redisplayPending = false;
+    lastFrameTime = start;
+    shownCursor = screenToWorld(mouseX - WIDTH/2, HEIGHT/2 - mouseY);
+    perf.glCalls = 0;
+    perf.sceneCached = !sceneDirty;
+
+    if (sceneDirty) {
+        drawScene();
+        cacheScene();
+        sceneDirty = false;
+    } else {
+        drawCachedScene();
+    }
+
+    // Capa superior: selección, vista previa, puntos temporales y coordenadas
+    if (selectedFigure >= 0) drawSelection();
+    if (!tempPoints.empty()) drawPreview();
+
+    glColor3f(1.0f, 0.0f, 0.0f);
+    glPointSize(5);
+    glBegin(GL_POINTS);
+    for (const Point& temp : tempPoints) {
+        Point p = worldToScreen(temp);
+        glVertex2i(p.x, p.y);
+    }
+    glEnd();
+    perf.glCalls += 4 + tempPoints.size();
+
+    if (showCoords) displayCoordinates();
+    if (showPerf) displayPerf();
+
+    glutSwapBuffers();
+    perf.frames++;
+    perf.frameMs = elapsedMs(start);
+}
+
+// Historial de deshacer/rehacer como registro de operaciones. Añadir guarda solo la
+// figura que retiró; borrar, limpiar o reemplazar la escena guardan una instantánea
+// O(1) de la lista, así deshacer o rehacer cualquier paso es O(1) aunque se limpien
+// millones de figuras. La instantánea de un borrado solo difiere de la lista en el
+// camino hasta el hueco, de modo que la memoria por operación sigue acotada.
+const int HISTORY_ADD = 0;
+const int HISTORY_REMOVE = 1;
+const int HISTORY_CLEAR = 2;
+const int HISTORY_REPLACE = 3;
+const size_t MAX_HISTORY = 1000;  // operaciones guardadas; las más antiguas se descartan
+
+struct HistoryOp {
+    int kind;
+    int index;                // posición de la figura añadida o borrada
+    Figure figure;            // la figura añadida mientras no está en la lista
+    FigureList snapshot;      // la otra versión de la lista al borrar, limpiar o reemplazar
+    PickIndex pick;           // índice de selección de la instantánea al limpiar o reemplazar
+};
+
+deque<HistoryOp> history;
+size_t historyPos = 0;  // operaciones [0, historyPos) aplicadas, el resto se puede rehacer
+
+void historyRecord(HistoryOp&& op) {
+    history.erase(history.begin() + historyPos, history.end());  // una acción nueva invalida rehacer
+    history.push_back(move(op));
+    if (history.size() > MAX_HISTORY) history.pop_front();
+    historyPos = history.size();
+    selectedFigure = -1;
+    invalidateScene();
+}
+
+void historyReset() {
+    history.clear();
+    historyPos = 0;
+}
+
+void addFigure(Figure&& figure) {
+    HistoryOp op;
+    op.kind = HISTORY_ADD;
+    op.index = figures.size();
+    figures.push_back(move(figure));
+    historyRecord(move(op));
+}
+
+void removeFigure(int index) {
+    HistoryOp op;
+    op.kind = HISTORY_REMOVE;
+    op.index = index;
+    op.snapshot = figures;
+    pickErase(figures.slotOf(index));
+    figures.erase(index);
+    historyRecord(move(op));
+}
+
+void clearFigures() {
+    if (figures.empty()) return;
+    HistoryOp op;
+    op.kind = HISTORY_CLEAR;
+    op.snapshot.swap(figures);
+    swap(op.pick, pickIndex);
+    historyRecord(move(op));
+}
+
+// La escena anterior queda en la instantánea: deshacer y rehacer solo intercambian listas
+void replaceFigures(FigureList&& scene) {
+    HistoryOp op;
+    op.kind = HISTORY_REPLACE;
+    op.snapshot.swap(figures);
+    swap(op.pick, pickIndex);
+    figures.swap(scene);
+    historyRecord(move(op));
+}
+
+void undo() {
+    if (historyPos == 0) return;
+    selectedFigure = -1;
+    invalidateScene();
+    HistoryOp& op = history[--historyPos];
+    switch (op.kind) {
+        case HISTORY_ADD:
+            op.figure = figures.back();
+            pickRemoveLast();
+            figures.pop_back();
+            break;
+        case HISTORY_REMOVE:
+            figures.swap(op.snapshot);  // la lista es la que dejó la operación
+            pickRestore(figures.slotOf(op.index));
+            break;
+        case HISTORY_CLEAR:
+        case HISTORY_REPLACE:
+            figures.swap(op.snapshot);
+            swap(pickIndex, op.pick);
+            break;
+    }
+}
+
+void redo() {
+    if (historyPos == history.size()) return;
+    selectedFigure = -1;
+    invalidateScene();
+    HistoryOp& op = history[historyPos++];
+    switch (op.kind) {
+        case HISTORY_ADD:
+            figures.push_back(move(op.figure));
+            break;
+        case HISTORY_REMOVE:
+            pickErase(figures.slotOf(op.index));
+            op.snapshot.swap(figures);
+            break;
+        case HISTORY_CLEAR:
+        case HISTORY_REPLACE:
+            op.snapshot.swap(figures);
+            swap(op.pick, pickIndex);
+            break;
+    }
+}
+
+// Convierte los puntos en construcción en una figura de la herramienta actual
+void commitTempFigure() {
+    Figure newFig;
+    newFig.type = currentTool;
+    newFig.thickness = currentThickness;
+    memcpy(newFig.color, currentColor, sizeof(currentColor));
+    newFig.points.swap(tempPoints);
+    tempPoints.clear();
+    addFigure(move(newFig));
+}
+
+// Intro: termina la polilínea, la curva o el polígono en construcción. Una Bézier necesita
+// tramos completos (4 puntos y 3 más por cada tramo siguiente); los sobrantes se descartan.
+void finishTempFigure() {
+    if (currentTool == POLYLINE_TYPE && tempPoints.size() >= 2) {
+        commitTempFigure();
+    } else if (isPolygonType(currentTool) && tempPoints.size() >= 3) {
+        commitTempFigure();
+    } else if (currentTool == BEZIER_TYPE && tempPoints.size() >= 4) {
+        tempPoints.resize(tempPoints.size() - (tempPoints.size() - 1) % 3);
+        commitTempFigure();
+    }
+}
+
+void mouse(int button, int state, int x, int y) {
+    // Rueda: acercar o alejar alrededor del cursor
+    if ((button == 3 || button == 4) && state == GLUT_DOWN) {
+        zoomAt(x - WIDTH/2, HEIGHT/2 - y, button == 3 ? ZOOM_STEP : 1 / ZOOM_STEP);
+        requestRedisplay();
+        return;
+    }
+    // Botón central: desplazar la vista arrastrando
+    if (button == GLUT_MIDDLE_BUTTON) {
+        panning = state == GLUT_DOWN;
+        panX = x; panY = y;
+        return;
+    }
+
+    if (button == GLUT_LEFT_BUTTON && state == GLUT_DOWN) {
+        mouseX = x; mouseY = y;
+
+        // Convertir coordenadas de ventana a coordenadas del mundo
+        Point p = screenToWorld(x - WIDTH/2, HEIGHT/2 - y);
+
+        if (currentTool == SELECT_TOOL) {
+            selectedFigure = pickFigure(p, viewScale);
+            requestRedisplay();
+            return;
+        }
+        if (currentTool == FLOOD_FILL_TYPE) {
+            Figure fill;
+            if (buildFloodFill(p, fill)) {
+                fill.thickness = 1;
+                memcpy(fill.color, currentColor, sizeof(currentColor));
+                unsigned long long version = sceneVersion;
+                addFigure(move(fill));
+                floodCanvasAppend(figures.back(), version);
+            } else {
+                cout << "La cubeta no encontro region bajo el clic" << endl;
+            }
+            requestRedisplay();
+            return;
+        }
+
+        tempPoints.push_back(p);
+
+        // Verificar si tenemos suficientes puntos para dibujar (polilíneas, curvas y
+        // polígonos siguen recibiendo puntos hasta pulsar Intro)
+        size_t count = tempPoints.size();
+        if ((currentTool <= 1 && count == 2) || // Rectas
+            ((currentTool == 2 || currentTool == 3) && count == 2) || // Círculos
+            (currentTool == 4 && count == 3) || // Elipses
+            (currentTool >= ROTATED_ELLIPSE_TYPE && currentTool <= ELLIPSE_ARC_TYPE &&
+             count == ellipseArcPoints(currentTool))) { // Elipses giradas y arcos
+            commitTempFigure();
+        }
+
+        requestRedisplay();
+    }
+}
+
+// Exportación PNG por flujo: se filtra y comprime fila a fila y los IDAT se
+// emiten por stbi_write_func a medida que se llenan, así la memoria pico es de
+// unas pocas filas más la ventana de 32 KB de deflate.
+const int PNG_STRIP_ROWS = 16;          // filas leídas de OpenGL por lote
+const int PNG_IDAT_SIZE = 64 * 1024;    // tamaño de cada chunk IDAT
+const int ZLIB_WINDOW = 32768;
+const int ZLIB_MAX_MATCH = 258;
+const int ZLIB_HASH_BITS = 15;
+
+void appendBE32(vector<unsigned char>& out, unsigned int v) {
+    out.push_back((v >> 24) & 0xFF);
+    out.push_back((v >> 16) & 0xFF);
+    out.push_back((v >> 8) & 0xFF);
+    out.push_back(v & 0xFF);
+}
+
+void appendPNGChunk(vector<unsigned char>& out, const char* type, const unsigned char* data, int len) {
+    appendBE32(out, len);
+    size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    if (len > 0) out.insert(out.end(), data, data + len);
+    appendBE32(out, stbiw__crc32(&out[start], len + 4));
+}
+
+struct PNGStream {
+    stbi_write_func* func;
+    void* context;
+    int rowBytes;       // bytes de una fila sin el byte de filtro
+    int bpp;            // distancia en bytes al píxel izquierdo para los filtros
+    bool adaptive;      // elegir filtro por fila (RGB) o filtro 0 (paleta)
+    vector<unsigned char> prevRow, filtered, best;
+
+    // Estado de deflate (Huffman fijo, un único bloque final como stb)
+    vector<unsigned char> window;   // últimos 32 KB ya codificados + datos pendientes
+    long long windowStart;          // posición absoluta de window[0]
+    long long pos;                  // siguiente posición absoluta a codificar
+    vector<long long> head, prev;   // cadenas hash: última aparición y anterior
+    unsigned int bitbuf;
+    int bitcount;
+    unsigned int adlerA, adlerB;
+    int adlerPending;
+
+    vector<unsigned char> idat, chunk;
+};
+
+void pngFlushIDAT(PNGStream& s) {
+    if (s.idat.empty()) return;
+    s.chunk.clear();
+    appendPNGChunk(s.chunk, "IDAT", s.idat.data(), (int)s.idat.size());
+    s.func(s.context, s.chunk.data(), (int)s.chunk.size());
+    s.idat.clear();
+}
+
+void zlibPutBits(PNGStream& s, unsigned int bits, int count) {
+    s.bitbuf |= bits << s.bitcount;
+    s.bitcount += count;
+    while (s.bitcount >= 8) {
+        s.idat.push_back(s.bitbuf & 0xFF);
+        s.bitbuf >>= 8;
+        s.bitcount -= 8;
+    }
+    if ((int)s.idat.size() >= PNG_IDAT_SIZE) pngFlushIDAT(s);
+}
+
+void zlibPutHuff(PNGStream& s, int code, int len) {
+    zlibPutBits(s, stbiw__zlib_bitrev(code, len), len);
+}
+
+void zlibPutLiteral(PNGStream& s, int v) {
+    if (v <= 143) zlibPutHuff(s, 0x30 + v, 8);
+    else if (v <= 255) zlibPutHuff(s, 0x190 + v - 144, 9);
+    else if (v <= 279) zlibPutHuff(s, v - 256, 7);
+    else zlibPutHuff(s, 0xc0 + v - 280, 8);
+}
+
+void zlibPutMatch(PNGStream& s, int len, int dist) {
+    static const unsigned short lengthc[] = { 3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258, 259 };
+    static const unsigned char  lengtheb[]= { 0,0,0,0,0,0,0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4,  4,  5,  5,  5,  5,  0 };
+    static const unsigned short distc[]   = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577, 32768 };
+    static const unsigned char  disteb[]  = { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
+    int j;
+    for (j = 0; len > lengthc[j + 1] - 1; ++j);
+    zlibPutLiteral(s, j + 257);
+    if (lengtheb[j]) zlibPutBits(s, len - lengthc[j], lengtheb[j]);
+    for (j = 0; dist > distc[j + 1] - 1; ++j);
+    zlibPutHuff(s, j, 5);
+    if (disteb[j]) zlibPutBits(s, dist - distc[j], disteb[j]);
+}
+
+unsigned int zlibHash(const unsigned char* p) {
+    return ((p[0] << 10) ^ (p[1] << 5) ^ p[2]) & ((1 << ZLIB_HASH_BITS) - 1);
+}
+
+void zlibInsert(PNGStream& s, long long p) {
+    unsigned int h = zlibHash(&s.window[p - s.windowStart]);
+    s.prev[p & (ZLIB_WINDOW - 1)] = s.head[h];
+    s.head[h] = p;
+}
+
+// Mejor coincidencia para la posición p recorriendo la cadena hash
+int zlibLongestMatch(PNGStream& s, long long p, long long end, long long& matchPos) {
+    const unsigned char* cur = &s.window[p - s.windowStart];
+    int maxLen = (int)min<long long>(ZLIB_MAX_MATCH, end - p);
+    int bestLen = 0;
+    int chain = 2 * max(stbi_write_png_compression_level, 5);
+    long long cand = s.head[zlibHash(cur)];
+
+    while (cand >= 0 && cand > p - ZLIB_WINDOW && chain-- > 0) {
+        const unsigned char* m = &s.window[cand - s.windowStart];
+        if (m[bestLen] == cur[bestLen]) {
+            int len = stbiw__zlib_countm((unsigned char*)m, (unsigned char*)cur, maxLen);
+            if (len > bestLen) {
+                bestLen = len;
+                matchPos = cand;
+                if (len == maxLen) break;
+            }
+        }
+        long long next = s.prev[cand & (ZLIB_WINDOW - 1)];
+        if (next >= cand) break;
+        cand = next;
+    }
+    return bestLen;
+}
+
+// Codifica lo pendiente; si no es el final deja sin codificar la cola que
+// todavía podría formar parte de una coincidencia más larga.
+void zlibCompress(PNGStream& s, bool final) {
+    TRACE_SCOPE("deflate");
+    long long end = s.windowStart + (long long)s.window.size();
+    long long limit = final ? end : end - ZLIB_MAX_MATCH;
+
+    while (s.pos < limit) {
+        long long p = s.pos;
+        if (end - p < 3) {
+            zlibPutLiteral(s, s.window[p - s.windowStart]);
+            s.pos++;
+            continue;
+        }
+
+        long long matchPos = -1;
+        int len = zlibLongestMatch(s, p, end, matchPos);
+        zlibInsert(s, p);
+
+        // Coincidencia perezosa: si la siguiente posición coincide mejor, literal ahora
+        if (len >= 3 && end - p >= 4) {
+            long long nextPos;
+            if (zlibLongestMatch(s, p + 1, end, nextPos) > len) len = 0;
+        }
+
+        if (len >= 3) {
+            zlibPutMatch(s, len, (int)(p - matchPos));
+            for (long long q = p + 1; q < p + len && q + 3 <= end; q++) zlibInsert(s, q);
+            s.pos = p + len;
+        } else {
+            zlibPutLiteral(s, s.window[p - s.windowStart]);
+            s.pos = p + 1;
+        }
+    }
+
+    // Conservar solo la ventana necesaria para referencias hacia atrás
+    long long keepFrom = s.pos - ZLIB_WINDOW;
+    if (keepFrom - s.windowStart >= ZLIB_WINDOW) {
+        s.window.erase(s.window.begin(), s.window.begin() + (keepFrom - s.windowStart));
+        s.windowStart = keepFrom;
+    }
+}
+
+void zlibWrite(PNGStream& s, const unsigned char* data, int len) {
+    for (int i = 0; i < len; i++) {
+        s.adlerA += data[i];
+        s.adlerB += s.adlerA;
+        if (++s.adlerPending == 5552) {
+            s.adlerA %= 65521;
+            s.adlerB %= 65521;
+            s.adlerPending = 0;
+        }
+    }
+    s.window.insert(s.window.end(), data, data + len);
+    zlibCompress(s, false);
+}
+
+void pngStreamBegin(PNGStream& s, stbi_write_func* func, void* context, int width, int height,
+                    int bits, int colorType, const vector<unsigned int>* palette) {
+    int channels = colorType == 2 ? 3 : 1;
+    s.func = func;
+    s.context = context;
+    s.rowBytes = (width * channels * bits + 7) / 8;
+    s.bpp = max(1, channels * bits / 8);
+    s.adaptive = colorType != 3;
+    s.prevRow.assign(s.rowBytes, 0);
+    s.filtered.resize(s.rowBytes + 1);
+    s.best.resize(s.rowBytes + 1);
+
+    s.window.clear();
+    s.window.reserve(2 * ZLIB_WINDOW + s.rowBytes + 1);
+    s.windowStart = 0;
+    s.pos = 0;
+    s.head.assign(1 << ZLIB_HASH_BITS, -1);
+    s.prev.assign(ZLIB_WINDOW, -1);
+    s.bitbuf = 0;
+    s.bitcount = 0;
+    s.adlerA = 1;
+    s.adlerB = 0;
+    s.adlerPending = 0;
+    s.idat.clear();
+    s.idat.reserve(PNG_IDAT_SIZE + 16);
+
+    static const unsigned char sig[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+    unsigned char ihdr[13];
+    unsigned char* o = ihdr;
+    stbiw__wp32(o, width);
+    stbiw__wp32(o, height);
+    *o++ = (unsigned char)bits;
+    *o++ = (unsigned char)colorType;
+    *o++ = 0;
+    *o++ = 0;
+    *o++ = 0;
+
+    s.chunk.assign(sig, sig + 8);
+    appendPNGChunk(s.chunk, "IHDR", ihdr, 13);
+    if (palette) {
+        vector<unsigned char> plte;
+        for (unsigned int color : *palette) {
+            plte.push_back((color >> 16) & 0xFF);
+            plte.push_back((color >> 8) & 0xFF);
+            plte.push_back(color & 0xFF);
+        }
+        appendPNGChunk(s.chunk, "PLTE", plte.data(), (int)plte.size());
+    }
+    func(context, s.chunk.data(), (int)s.chunk.size());
+
+    s.idat.push_back(0x78);   // DEFLATE ventana 32K
+    s.idat.push_back(0x5e);   // FLEVEL = 1
+    zlibPutBits(s, 1, 1);     // BFINAL = 1
+    zlibPutBits(s, 1, 2);     // BTYPE = 1, Huffman fijo
+}
+
+// Filtra una fila ya empaquetada (mismos filtros y heurística que stb) y la comprime
+void pngStreamRow(PNGStream& s, const unsigned char* row) {
+    int n = s.rowBytes, bpp = s.bpp;
+    const unsigned char* up = s.prevRow.data();
+    int bestEst = 0x7fffffff;
+
+    {
+        TRACE_SCOPE("filter");
+        for (int type = 0; type < (s.adaptive ? 5 : 1); type++) {
+            unsigned char* f = s.filtered.data() + 1;
+            s.filtered[0] = (unsigned char)type;
+            switch (type) {
+                case 0: memcpy(f, row, n); break;
+                case 1: for (int i = 0; i < n; i++) f[i] = row[i] - (i >= bpp ? row[i - bpp] : 0); break;
+                case 2: for (int i = 0; i < n; i++) f[i] = row[i] - up[i]; break;
+                case 3: for (int i = 0; i < n; i++) f[i] = row[i] - (((i >= bpp ? row[i - bpp] : 0) + up[i]) >> 1); break;
+                case 4: for (int i = 0; i < n; i++)
+                            f[i] = row[i] - stbiw__paeth(i >= bpp ? row[i - bpp] : 0, up[i], i >= bpp ? up[i - bpp] : 0);
+                        break;
+            }
+            if (!s.adaptive) {
+                s.best.swap(s.filtered);
+                break;
+            }
+            int est = 0;
+            for (int i = 0; i < n; i++) est += abs((signed char)f[i]);
+            if (est < bestEst) {
+                bestEst = est;
+                s.best.swap(s.filtered);
+            }
+        }
+    }
+
+    memcpy(s.prevRow.data(), row, n);
+    zlibWrite(s, s.best.data(), n + 1);
+}
+
+void pngStreamEnd(PNGStream& s) {
+    zlibCompress(s, true);
+    zlibPutLiteral(s, 256);   // fin de bloque
+    if (s.bitcount) zlibPutBits(s, 0, 8 - s.bitcount);
+    appendBE32(s.idat, ((s.adlerB % 65521) << 16) | (s.adlerA % 65521));
+    pngFlushIDAT(s);
+
+    s.chunk.clear();
+    appendPNGChunk(s.chunk, "IEND", nullptr, 0);
+    s.func(s.context, s.chunk.data(), (int)s.chunk.size());
+}
+
+// Paleta de hasta 256 colores construida a medida que se recorren las filas
+struct Palette {
+    vector<unsigned int> colors;
+    unordered_map<unsigned int, unsigned char> lookup;
+    unsigned int lastColor = 0xFFFFFFFF;
+    unsigned char lastIndex = 0;
+};
+
+// Asigna un índice de paleta a cada píxel RGB (si indices no es nulo).
+// Devuelve false si aparece el color número 257.
+bool paletteMapRow(Palette& pal, const unsigned char* rgb, int count, unsigned char* indices) {
+    for (int i = 0; i < count; i++) {
+        const unsigned char* px = &rgb[3 * i];
+        unsigned int color = (px[0] << 16) | (px[1] << 8) | px[2];
+
+        // La mayoría de los píxeles repiten el color anterior (fondo, trazos)
+        if (color != pal.lastColor) {
+            auto it = pal.lookup.find(color);
+            if (it == pal.lookup.end()) {
+                if (pal.colors.size() == 256) return false;
+                pal.lastIndex = (unsigned char)pal.colors.size();
+                pal.lookup[color] = pal.lastIndex;
+                pal.colors.push_back(color);
+            } else {
+                pal.lastIndex = it->second;
+            }
+            pal.lastColor = color;
+        }
+        if (indices) indices[i] = pal.lastIndex;
+    }
+    return true;
+}
+
+// Escribe un PNG a partir de filas RGB pedidas de arriba hacia abajo. Con indexed
+// se hace una primera pasada para la paleta y se usa 1, 2, 4 u 8 bits por píxel;
+// si hay más de 256 colores se escribe RGB. Devuelve el número de colores (0 en RGB).
+int writePNGStream(PNGStream& s, stbi_write_func* func, void* context, int width, int height,
+                   const function<const unsigned char*(int)>& rowAt, bool indexed) {
+    Palette pal;
+
+    if (indexed) {
+        for (int y = 0; y < height && indexed; y++) {
+            indexed = paletteMapRow(pal, rowAt(y), width, nullptr);
+        }
+        if (!indexed) cout << "Mas de 256 colores, exportando en RGB" << endl;
+    }
+
+    if (!indexed) {
+        pngStreamBegin(s, func, context, width, height, 8, 2, nullptr);
+        for (int y = 0; y < height; y++) pngStreamRow(s, rowAt(y));
+        pngStreamEnd(s);
+        return 0;
+    }
+
+    size_t colors = pal.colors.size();
+    int bits = colors <= 2 ? 1 : colors <= 4 ? 2 : colors <= 16 ? 4 : 8;
+    int perByte = 8 / bits;
+    vector<unsigned char> indices(width), packed((width * bits + 7) / 8);
+
+    pngStreamBegin(s, func, context, width, height, bits, 3, &pal.colors);
+    for (int y = 0; y < height; y++) {
+        paletteMapRow(pal, rowAt(y), width, indices.data());
+        if (bits == 8) {
+            pngStreamRow(s, indices.data());
+            continue;
+        }
+        fill(packed.begin(), packed.end(), 0);
+        for (int x = 0; x < width; x++) {
+            packed[x / perByte] |= indices[x] << (8 - bits * (x % perByte + 1));
+        }
+        pngStreamRow(s, packed.data());
+    }
+    pngStreamEnd(s);
+    return (int)colors;
 }
 
-void drawLineDirect(Point p1, Point p2) {
-    if (p1.x == p2.x) { // Línea vertical
-        int y1 = min(p1.y, p2.y);
-        int y2 = max(p1.y, p2.y);
-        for (int y = y1; y <= y2; y++) {
-            drawPixel(p1.x, y);
-        }
+// Escritura a archivo midiendo el tiempo para los contadores de exportación
+void timedFileWrite(void* context, void* data, int size) {
+    auto start = chrono::steady_clock::now();
+    fwrite(data, 1, size, (FILE*)context);
+    perf.exportWriteMs += elapsedMs(start);
+}
+
+void savePNG(const char* filename, int width, int height, bool indexed = false) {
+    TRACE_SCOPE("savePNG");
+    auto start = chrono::steady_clock::now();
+    perf.exportReadMs = perf.exportWriteMs = 0;
+    FILE* f = stbiw__fopen(filename, "wb");
+    if (!f) {
+        cout << "Error al exportar PNG" << endl;
         return;
     }
 
-    float m = float(p2.y - p1.y) / (p2.x - p1.x);
-    float b = p1.y - m * p1.x;
-
-    if (abs(m) <= 1.0f) {
-        int x1 = min(p1.x, p2.x);
-        int x2 = max(p1.x, p2.x);
-        for (int x = x1; x <= x2; x++) {
-            int y = round(m * x + b);
-            drawPixel(x, y);
+    // Lectura por franjas: OpenGL entrega las filas de abajo hacia arriba
+    vector<unsigned char> strip(3 * width * PNG_STRIP_ROWS);
+    int stripTop = -1, stripRows = 0;
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    auto rowAt = [&](int y) -> const unsigned char* {
+        if (stripTop < 0 || y < stripTop || y >= stripTop + stripRows) {
+            stripTop = y - y % PNG_STRIP_ROWS;
+            stripRows = min(PNG_STRIP_ROWS, height - stripTop);
+            TRACE_SCOPE("readback");
+            auto readStart = chrono::steady_clock::now();
+            glReadPixels(0, height - stripTop - stripRows, width, stripRows,
+                         GL_RGB, GL_UNSIGNED_BYTE, strip.data());
+            perf.exportReadMs += elapsedMs(readStart);
         }
+        return &strip[3 * width * (stripTop + stripRows - 1 - y)];
+    };
+
+    PNGStream s;
+    int colors = writePNGStream(s, timedFileWrite, f, width, height, rowAt, indexed);
+    bool ok = !ferror(f);
+    fclose(f);
+    perf.exportTotalMs = elapsedMs(start);
+    perf.exportEncodeMs = perf.exportTotalMs - perf.exportReadMs - perf.exportWriteMs;
+
+    if (!ok) {
+        cout << "Error al exportar PNG" << endl;
+    } else if (colors > 0) {
+        cout << "Imagen exportada como " << filename << " (" << colors << " colores)" << endl;
     } else {
-        int y1 = min(p1.y, p2.y);
-        int y2 = max(p1.y, p2.y);
-        for (int y = y1; y <= y2; y++) {
-            int x = round((y - b) / m);
-            drawPixel(x, y);
-        }
+        cout << "Imagen exportada como " << filename << endl;
     }
 }
 
-void drawLineDDA(Point p1, Point p2) {
-    int dx = p2.x - p1.x;
-    int dy = p2.y - p1.y;
-    int steps = max(abs(dx), abs(dy));
+// Exportación SVG directamente desde la lista de figuras. En modo vectorial cada
+// figura es un elemento <line>/<circle>/<ellipse>; con exactPixels se rasteriza
+// con su algoritmo y se emiten las corridas horizontales de píxeles resultantes.
+string svgColor(const float color[3]) {
+    return "rgb(" + to_string((int)lround(color[0] * 255)) + "," +
+           to_string((int)lround(color[1] * 255)) + "," +
+           to_string((int)lround(color[2] * 255)) + ")";
+}
 
-    if (steps == 0) {
-        drawPixel(p1.x, p1.y);
+void writeSVGPixelRuns(ostream& out, const Figure& figure, vector<Point>& pixels) {
+    pixels.clear();
+    CaptureSink sink(pixels);
+    drawFigure(sink, figure);
+    if (pixels.empty()) return;
+
+    sort(pixels.begin(), pixels.end(), [](const Point& a, const Point& b) {
+        return a.y != b.y ? a.y > b.y : a.x < b.x;
+    });
+
+    // Cada píxel es un cuadrado de lado thickness centrado como glPointSize (los
+    // rellenos no usan el grosor)
+    int t = isPolygonType(figure.type) || figure.type == FLOOD_FILL_TYPE ? 1 : max(figure.thickness, 1);
+    int half = t / 2;
+    out << "<path fill=\"" << svgColor(figure.color) << "\" d=\"";
+    size_t i = 0;
+    while (i < pixels.size()) {
+        size_t j = i + 1;
+        while (j < pixels.size() && pixels[j].y == pixels[i].y && pixels[j].x <= pixels[j - 1].x + 1) j++;
+        int run = pixels[j - 1].x - pixels[i].x + 1;
+        out << "M" << pixels[i].x + WIDTH/2 - half << " " << HEIGHT/2 - pixels[i].y - (t - half)
+            << "h" << run + t - 1 << "v" << t << "h-" << run + t - 1 << "z";
+        i = j;
+    }
+    out << "\"/>\n";
+}
+
+void saveSVG(const char* filename, bool exactPixels) {
+    TRACE_SCOPE("saveSVG");
+    ofstream out(filename);
+    if (!out) {
+        cout << "Error al exportar SVG" << endl;
         return;
     }
 
-    float xInc = dx / (float)steps;
-    float yInc = dy / (float)steps;
+    // Coordenadas SVG: origen arriba a la izquierda, y hacia abajo
+    auto sx = [](int x) { return x + WIDTH/2; };
+    auto sy = [](int y) { return HEIGHT/2 - y; };
 
-    float x = p1.x;
-    float y = p1.y;
+    out << "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"" << WIDTH << "\" height=\"" << HEIGHT
+        << "\" viewBox=\"0 0 " << WIDTH << " " << HEIGHT << "\">\n";
+    out << "<rect width=\"100%\" height=\"100%\" fill=\"white\"/>\n";
 
-    for (int i = 0; i <= steps; i++) {
-        drawPixel(round(x), round(y));
-        x += xInc;
-        y += yInc;
+    if (showGrid) {
+        out << "<g stroke=\"rgb(230,230,230)\" stroke-width=\"1\">\n";
+        for (int x = -WIDTH/2; x <= WIDTH/2; x += GRID_SPACING)
+            out << "<line x1=\"" << sx(x) << "\" y1=\"0\" x2=\"" << sx(x) << "\" y2=\"" << HEIGHT << "\"/>\n";
+        for (int y = -HEIGHT/2; y <= HEIGHT/2; y += GRID_SPACING)
+            out << "<line x1=\"0\" y1=\"" << sy(y) << "\" x2=\"" << WIDTH << "\" y2=\"" << sy(y) << "\"/>\n";
+        out << "</g>\n";
+    }
+    if (showAxes) {
+        out << "<g stroke=\"black\" stroke-width=\"1\">\n";
+        out << "<line x1=\"0\" y1=\"" << sy(0) << "\" x2=\"" << WIDTH << "\" y2=\"" << sy(0) << "\"/>\n";
+        out << "<line x1=\"" << sx(0) << "\" y1=\"0\" x2=\"" << sx(0) << "\" y2=\"" << HEIGHT << "\"/>\n";
+        out << "</g>\n";
     }
-}
 
-void drawCircleIncremental(Point center, int radius) {
-    float angle = 0;
-    float angleIncrement = 1.0f / radius;
+    vector<Point> pixels;
+    for (const auto& figure : figures) {
+        if (exactPixels) {
+            writeSVGPixelRuns(out, figure, pixels);
+            continue;
+        }
 
-    while (angle < 2 * M_PI) {
-        int x = center.x + radius * cos(angle);
-        int y = center.y + radius * sin(angle);
-        drawPixel(x, y);
-        angle += angleIncrement;
+        string stroke = " fill=\"none\" stroke=\"" + svgColor(figure.color) +
+                        "\" stroke-width=\"" + to_string(figure.thickness) + "\"";
+        const vector<Point>& p = figure.points;
+        switch (figure.type) {
+            case 0: case 1: // Rectas
+                if (p.size() >= 2)
+                    out << "<line x1=\"" << sx(p[0].x) << "\" y1=\"" << sy(p[0].y) << "\" x2=\"" << sx(p[1].x)
+                        << "\" y2=\"" << sy(p[1].y) << "\" stroke-linecap=\"square\"" << stroke << "/>\n";
+                break;
+            case 2: case 3: // Círculos
+                if (p.size() >= 2)
+                    out << "<circle cx=\"" << sx(p[0].x) << "\" cy=\"" << sy(p[0].y) << "\" r=\""
+                        << circleRadius(figure) << "\"" << stroke << "/>\n";
+                break;
+            case 4: // Elipse
+                if (p.size() >= 3)
+                    out << "<ellipse cx=\"" << sx(p[0].x) << "\" cy=\"" << sy(p[0].y) << "\" rx=\""
+                        << ellipseRx(figure) << "\" ry=\"" << ellipseRy(figure) << "\"" << stroke << "/>\n";
+                break;
+            case POLYLINE_TYPE:
+                if (p.size() >= 2) {
+                    out << "<polyline points=\"";
+                    for (size_t i = 0; i < p.size(); i++) out << (i ? " " : "") << sx(p[i].x) << "," << sy(p[i].y);
+                    out << "\" stroke-linejoin=\"miter\" stroke-linecap=\"square\"" << stroke << "/>\n";
+                }
+                break;
+            case BEZIER_TYPE:
+                if (p.size() >= 4) {
+                    out << "<path d=\"M " << sx(p[0].x) << " " << sy(p[0].y);
+                    for (size_t i = 1; i + 2 < p.size(); i += 3) {
+                        out << " C " << sx(p[i].x) << " " << sy(p[i].y) << " " << sx(p[i + 1].x) << " "
+                            << sy(p[i + 1].y) << " " << sx(p[i + 2].x) << " " << sy(p[i + 2].y);
+                    }
+                    out << "\" stroke-linecap=\"square\"" << stroke << "/>\n";
+                }
+                break;
+            case POLYGON_EVEN_ODD_TYPE: case POLYGON_NONZERO_TYPE:
+                if (p.size() >= 3) {
+                    out << "<polygon points=\"";
+                    for (size_t i = 0; i < p.size(); i++) out << (i ? " " : "") << sx(p[i].x) << "," << sy(p[i].y);
+                    out << "\" fill=\"" << svgColor(figure.color) << "\" fill-rule=\""
+                        << (figure.type == POLYGON_NONZERO_TYPE ? "nonzero" : "evenodd") << "\"/>\n";
+                }
+                break;
+            case ROTATED_ELLIPSE_TYPE: case CIRCLE_ARC_TYPE: case ELLIPSE_ARC_TYPE:
+                if (p.size() >= ellipseArcPoints(figure.type)) {
+                    EllipseShape e = figureEllipseShape(figure);
+                    CurvePoint from, to;
+                    bool closed;
+                    figureArcRange(figure, e, from, to, closed);
+                    double degrees = -atan2(e.sinT, e.cosT) * 180 / M_PI;  // en SVG la y crece hacia abajo
+                    if (closed) {
+                        out << "<ellipse cx=\"" << sx(p[0].x) << "\" cy=\"" << sy(p[0].y) << "\" rx=\"" << e.a
+                            << "\" ry=\"" << e.b << "\" transform=\"rotate(" << degrees << " " << sx(p[0].x) << " "
+                            << sy(p[0].y) << ")\"" << stroke << "/>\n";
+                        break;
+                    }
+                    Conic k = ellipseConic(e);
+                    CurvePoint s = conicPointInDirection(k, from), t = conicPointInDirection(k, to);
+                    double sweep = atan2(from.x * to.y - from.y * to.x, from.x * to.x + from.y * to.y);
+                    if (sweep < 0) sweep += 2 * M_PI;
+                    // Antihorario en pantalla es sweep-flag 0
+                    out << "<path d=\"M " << sx(p[0].x) + s.x << " " << sy(p[0].y) - s.y << " A " << e.a << " "
+                        << e.b << " " << degrees << " " << (sweep > M_PI ? 1 : 0) << " 0 " << sx(p[0].x) + t.x
+                        << " " << sy(p[0].y) - t.y << "\" stroke-linecap=\"square\"" << stroke << "/>\n";
+                }
+                break;
+            case FLOOD_FILL_TYPE: // La región no tiene forma vectorial: se escribe por tramos
+                writeSVGPixelRuns(out, figure, pixels);
+                break;
+        }
+    }
+
+    out << "</svg>\n";
+    if (out) {
+        cout << "Imagen exportada como " << filename << endl;
+    } else {
+        cout << "Error al exportar SVG" << endl;
     }
 }
 
-void drawCircleMidpoint(Point center, int radius) {
-    int x = 0;
-    int y = radius;
-    int d = 1 - radius;
+// Escenas en texto plano, una figura por línea:
+//   grid 0|1
+//   axes 0|1
+//   fig <tipo> <r> <g> <b> <grosor> <n> <x1> <y1> ... <xn> <yn>
+bool saveScene(const char* filename, const FigureList& scene, bool grid, bool axes) {
+    TRACE_SCOPE("saveScene");
+    ofstream out(filename);
+    if (!out) return false;
+    out << "grid " << grid << "\n" << "axes " << axes << "\n";
+    for (const auto& figure : scene) {
+        out << "fig " << figure.type << " " << figure.color[0] << " " << figure.color[1] << " "
+            << figure.color[2] << " " << figure.thickness << " " << figure.points.size();
+        for (const auto& p : figure.points) out << " " << p.x << " " << p.y;
+        out << "\n";
+    }
+    return (bool)out;
+}
 
-    while (x <= y) {
-        // Dibujar los 8 octantes
-        drawPixel(center.x + x, center.y + y);
-        drawPixel(center.x - x, center.y + y);
-        drawPixel(center.x + x, center.y - y);
-        drawPixel(center.x - x, center.y - y);
-        drawPixel(center.x + y, center.y + x);
-        drawPixel(center.x - y, center.y + x);
-        drawPixel(center.x + y, center.y - x);
-        drawPixel(center.x - y, center.y - x);
+bool loadScene(const char* filename, FigureList& scene, bool& grid, bool& axes) {
+    TRACE_SCOPE("loadScene");
+    ifstream in(filename);
+    if (!in) return false;
 
-        if (d < 0) {
-            d += 2 * x + 3;
-        } else {
-            d += 2 * (x - y) + 5;
-            y--;
+    scene.clear();
+    string line, tag;
+    while (getline(in, line)) {
+        istringstream ss(line);
+        if (!(ss >> tag) || tag[0] == '#') continue;
+        if (tag == "grid") {
+            ss >> grid;
+        } else if (tag == "axes") {
+            ss >> axes;
+        } else if (tag == "fig") {
+            Figure fig;
+            int n = 0;
+            ss >> fig.type >> fig.color[0] >> fig.color[1] >> fig.color[2] >> fig.thickness >> n;
+            for (int i = 0; i < n; i++) {
+                Point p;
+                ss >> p.x >> p.y;
+                fig.points.push_back(p);
+            }
+            if (!ss) return false;
+            scene.push_back(fig);
         }
-        x++;
     }
+    return true;
 }
 
-void drawEllipseMidpoint(Point center, int rx, int ry) {
-    if (rx <= 0 || ry <= 0) return;
+// Exportación por lotes sin ventana: proyecto-DMV-A --batch lista.txt [hilos] [--indexed]
+// Cada línea de la lista es "escena.txt salida.png" (o .jpg). Cada escena es una tarea;
+// los hilos toman de su propia cola y, cuando se vacía, roban del final de las demás.
+struct BatchJob {
+    string scene, output;
+};
 
-    int x = 0;
-    int y = ry;
-    int rx2 = rx * rx;
-    int ry2 = ry * ry;
-    int twoRx2 = 2 * rx2;
-    int twoRy2 = 2 * ry2;
+struct BatchWorker {
+    mutex lock;
+    deque<int> tasks;
 
-    // Región 1
-    int p = round(ry2 - (rx2 * ry) + (0.25 * rx2));
-    int px = 0;
-    int py = twoRx2 * y;
+    // Búferes reutilizados entre tareas del mismo hilo
+    Framebuffer fb;
+    PNGStream png;
+    FigureList scene;
+    vector<unsigned char> encoded;
 
-    while (px < py) {
-        drawPixel(center.x + x, center.y + y);
-        drawPixel(center.x - x, center.y + y);
-        drawPixel(center.x + x, center.y - y);
-        drawPixel(center.x - x, center.y - y);
+    double loadTime = 0, rasterTime = 0, encodeTime = 0, writeTime = 0;
+    int done = 0, failed = 0;
+};
 
-        x++;
-        px += twoRy2;
+void appendToBuffer(void* context, void* data, int size) {
+    vector<unsigned char>* out = (vector<unsigned char>*)context;
+    out->insert(out->end(), (unsigned char*)data, (unsigned char*)data + size);
+}
 
-        if (p < 0) {
-            p += ry2 + px;
+bool takeBatchTask(vector<BatchWorker>& workers, int self, int& task) {
+    int n = workers.size();
+    for (int k = 0; k < n; k++) {
+        BatchWorker& w = workers[(self + k) % n];
+        lock_guard<mutex> guard(w.lock);
+        if (w.tasks.empty()) continue;
+        if (k == 0) {
+            task = w.tasks.front();
+            w.tasks.pop_front();
         } else {
-            y--;
-            py -= twoRx2;
-            p += ry2 + px - py;
+            task = w.tasks.back();
+            w.tasks.pop_back();
         }
+        return true;
     }
+    return false;
+}
 
-    // Región 2
-    p = round(ry2 * (x + 0.5) * (x + 0.5) + rx2 * (y - 1) * (y - 1) - rx2 * ry2);
+void runBatchWorker(vector<BatchWorker>& workers, int self, const vector<BatchJob>& jobs, bool indexed) {
+    typedef chrono::steady_clock Clock;
+    auto seconds = [](Clock::time_point a, Clock::time_point b) {
+        return chrono::duration<double>(b - a).count();
+    };
+    BatchWorker& w = workers[self];
+    int task;
 
-    while (y >= 0) {
-        drawPixel(center.x + x, center.y + y);
-        drawPixel(center.x - x, center.y + y);
-        drawPixel(center.x + x, center.y - y);
-        drawPixel(center.x - x, center.y - y);
+    while (takeBatchTask(workers, self, task)) {
+        const BatchJob& job = jobs[task];
+        bool grid = true, axes = true;
 
-        y--;
-        py -= twoRx2;
+        TRACE_SCOPE("scene");
+        auto t0 = Clock::now();
+        if (!loadScene(job.scene.c_str(), w.scene, grid, axes)) {
+            cerr << "No se pudo leer la escena " << job.scene << endl;
+            w.failed++;
+            continue;
+        }
 
-        if (p > 0) {
-            p += rx2 - py;
+        auto t1 = Clock::now();
+        clearFramebuffer(w.fb, WIDTH, HEIGHT);
+        renderFramebuffer(w.fb, w.scene, grid, axes);
+
+        auto t2 = Clock::now();
+        w.encoded.clear();
+        string ext = job.output.substr(job.output.find_last_of('.') + 1);
+        if (ext == "jpg" || ext == "jpeg") {
+            TRACE_SCOPE("encodeJPG");
+            stbi_write_jpg_to_func(appendToBuffer, &w.encoded, w.fb.width, w.fb.height, 3, w.fb.rgb.data(), 90);
         } else {
-            x++;
-            px += twoRy2;
-            p += rx2 - py + px;
+            TRACE_SCOPE("encodePNG");
+            int stride = 3 * w.fb.width;
+            writePNGStream(w.png, appendToBuffer, &w.encoded, w.fb.width, w.fb.height,
+                           [&](int y) { return &w.fb.rgb[y * stride]; }, indexed);
         }
+
+        auto t3 = Clock::now();
+        FILE* f = stbiw__fopen(job.output.c_str(), "wb");
+        bool ok = f && fwrite(w.encoded.data(), 1, w.encoded.size(), f) == w.encoded.size();
+        if (f) fclose(f);
+        auto t4 = Clock::now();
+
+        if (!ok) {
+            cerr << "No se pudo escribir " << job.output << endl;
+            w.failed++;
+            continue;
+        }
+        w.loadTime += seconds(t0, t1);
+        w.rasterTime += seconds(t1, t2);
+        w.encodeTime += seconds(t2, t3);
+        w.writeTime += seconds(t3, t4);
+        w.done++;
     }
 }
 
-// Funciones de dibujo auxiliares
-void drawGrid() {
-    glColor3f(0.9f, 0.9f, 0.9f);  // gris claro
-    glBegin(GL_LINES);
-    for (int x = -WIDTH/2; x <= WIDTH/2; x += GRID_SPACING) {
-        glVertex2i(x, -HEIGHT/2);
-        glVertex2i(x, HEIGHT/2);
+int runBatch(const char* listFile, int threadCount, bool indexed) {
+    ifstream in(listFile);
+    if (!in) {
+        cerr << "No se pudo abrir la lista " << listFile << endl;
+        return 1;
     }
-    for (int y = -HEIGHT/2; y <= HEIGHT/2; y += GRID_SPACING) {
-        glVertex2i(-WIDTH/2, y);
-        glVertex2i(WIDTH/2, y);
+    vector<BatchJob> jobs;
+    BatchJob job;
+    while (in >> job.scene >> job.output) jobs.push_back(job);
+
+    if (threadCount <= 0) threadCount = max(1u, thread::hardware_concurrency());
+    threadCount = max(1, min(threadCount, (int)jobs.size()));
+
+    vector<BatchWorker> workers(threadCount);
+    for (int i = 0; i < (int)jobs.size(); i++) workers[i % threadCount].tasks.push_back(i);
+
+    auto start = chrono::steady_clock::now();
+    vector<thread> threads;
+    for (int i = 0; i < threadCount; i++)
+        threads.emplace_back(runBatchWorker, ref(workers), i, cref(jobs), indexed);
+    for (auto& t : threads) t.join();
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    int done = 0, failed = 0;
+    double load = 0, raster = 0, encode = 0, write = 0;
+    for (auto& w : workers) {
+        done += w.done;
+        failed += w.failed;
+        load += w.loadTime;
+        raster += w.rasterTime;
+        encode += w.encodeTime;
+        write += w.writeTime;
     }
-    glEnd();
-}
 
-void drawAxes() {
-    glColor3f(0.0f, 0.0f, 0.0f);  // negro
-    glBegin(GL_LINES);
-    // Eje X
-    glVertex2i(-WIDTH/2, 0);
-    glVertex2i(WIDTH/2, 0);
-    // Eje Y
-    glVertex2i(0, -HEIGHT/2);
-    glVertex2i(0, HEIGHT/2);
-    glEnd();
+    auto perScene = [done](double total) { return done ? 1000.0 * total / done : 0.0; };
+    cout << "Lote: " << done << " escenas (" << failed << " errores) en " << elapsed << " s con "
+         << threadCount << " hilos, " << (elapsed > 0 ? done / elapsed : 0.0) << " escenas/s" << endl;
+    cout << "  carga:        " << perScene(load) << " ms/escena" << endl;
+    cout << "  rasterizado:  " << perScene(raster) << " ms/escena" << endl;
+    cout << "  codificacion: " << perScene(encode) << " ms/escena" << endl;
+    cout << "  escritura:    " << perScene(write) << " ms/escena" << endl;
+    return failed ? 1 : 0;
 }
 
+// Autoguardado en segundo plano, solo con --autosave archivo: la ventana toma una
+// instantánea O(1) de la lista y otro hilo la escribe mientras se sigue dibujando.
+// El hilo se espera antes del siguiente guardado y al salir, así nunca queda un
+// archivo a medio escribir.
+const int AUTOSAVE_MS = 30000;
+const char* autosavePath = nullptr;
+atomic<bool> autosaveBusy(false);
+thread autosaveWriter;
+unsigned long long autosavedVersion = 0;
 
-void displayCoordinates() {
-    glMatrixMode(GL_PROJECTION);
-    glPushMatrix();
-    glLoadIdentity();
-    gluOrtho2D(0, WIDTH, HEIGHT, 0);
-    glMatrixMode(GL_MODELVIEW);
-    glPushMatrix();
-    glLoadIdentity();
+void autosaveFinish() {
+    if (autosaveWriter.joinable()) autosaveWriter.join();
+}
 
-    glColor3f(1.0f, 1.0f, 1.0f);
-    glRasterPos2i(10, 20);
-    string coords = "X: " + to_string(mouseX - WIDTH/2) + " Y: " + to_string(HEIGHT/2 - mouseY);
-    for (char c : coords) {
-        glutBitmapCharacter(GLUT_BITMAP_9_BY_15, c);
+void autosave(int) {
+    if (sceneVersion != autosavedVersion && !autosaveBusy) {
+        autosaveFinish();
+        autosaveBusy = true;
+        autosavedVersion = sceneVersion;
+        FigureList snapshot = figures;
+        bool grid = showGrid, axes = showAxes;
+        autosaveWriter = thread([snapshot, grid, axes]() {
+            if (!saveScene(autosavePath, snapshot, grid, axes))
+                cerr << "No se pudo autoguardar en " << autosavePath << endl;
+            autosaveBusy = false;
+        });
     }
-
-    glPopMatrix();
-    glMatrixMode(GL_PROJECTION);
-    glPopMatrix();
-    glMatrixMode(GL_MODELVIEW);
+    glutTimerFunc(AUTOSAVE_MS, autosave, 0);
 }
 
-// Callbacks de OpenGL
-void display() {
-    glClear(GL_COLOR_BUFFER_BIT);
+// Escenas de prueba reproducibles y benchmark de frames. La misma semilla y
+// configuración generan siempre la misma escena, así se pueden comparar cambios
+// de rasterizado sobre la misma carga:
+//   proyecto-DMV-A --stress [N] [--seed S] [--frames F] [--size min max] [--log]
+//   proyecto-DMV-A --stress-scene escena.txt [N] [--seed S] [--size min max] [--log]
+// La segunda forma solo guarda la escena (sin ventana) para dibujarla con --batch.
+// Con sincronía vertical activa los frames no bajan del intervalo de refresco
+// (en Mesa se desactiva con vblank_mode=0, en NVIDIA con __GL_SYNC_TO_VBLANK=0).
+struct StressConfig {
+    int count = 100000;
+    unsigned seed = 1;
+    int frames = 60;
+    int minSize = 2;       // tamaño (longitud o radio) en unidades del mundo
+    int maxSize = 200;
+    bool logSizes = false; // distribución log-uniforme: muchas figuras pequeñas y pocas grandes
+};
 
-    if (showGrid) drawGrid();
-    if (showAxes) drawAxes();
+bool stressRequested = false;
+StressConfig stressConfig;
 
-    // Dibujar todas las figuras
-    for (const auto& figure : figures) {
-        glColor3fv(figure.color);
-        currentThickness = figure.thickness;
+void generateStressScene(FigureList& out, const StressConfig& config) {
+    mt19937 rng(config.seed);
+    uniform_int_distribution<int> typeDist(0, 4);  // los cinco tipos originales: misma escena por semilla
+    uniform_int_distribution<int> xDist(-WIDTH/2, WIDTH/2), yDist(-HEIGHT/2, HEIGHT/2);
+    uniform_real_distribution<double> unit(0.0, 1.0);
+    const int thicknesses[] = {1, 1, 1, 2, 3, 5};
+    uniform_int_distribution<int> thicknessDist(0, 5);
 
-        switch (figure.type) {
-            case 0: // Recta directo
-                if (figure.points.size() >= 2)
-                    drawLineDirect(figure.points[0], figure.points[1]);
-                break;
-            case 1: // Recta DDA
-                if (figure.points.size() >= 2)
-                    drawLineDDA(figure.points[0], figure.points[1]);
-                break;
-            case 2: // Círculo incremental
-                if (figure.points.size() >= 2) {
-                    int dx = figure.points[1].x - figure.points[0].x;
-                    int dy = figure.points[1].y - figure.points[0].y;
-                    int radius = (int)sqrt(dx*dx + dy*dy);
-                    drawCircleIncremental(figure.points[0], radius);
-                }
-                break;
-            case 3: // Círculo PM
-                if (figure.points.size() >= 2) {
-                    int dx = figure.points[1].x - figure.points[0].x;
-                    int dy = figure.points[1].y - figure.points[0].y;
-                    int radius = (int)sqrt(dx*dx + dy*dy);
-                    drawCircleMidpoint(figure.points[0], radius);
-                }
-                break;
-            case 4: // Elipse PM
-                if (figure.points.size() >= 3) {
-                    int rx = abs(figure.points[1].x - figure.points[0].x);
-                    int ry = abs(figure.points[2].y - figure.points[0].y);
-                    drawEllipseMidpoint(figure.points[0], rx, ry);
-                }
-                break;
+    auto size = [&]() {
+        double u = unit(rng);
+        double lo = max(config.minSize, 1), hi = max(config.maxSize, config.minSize);
+        return (int)lround(config.logSizes ? lo * pow(hi / lo, u) : lo + (hi - lo) * u);
+    };
+
+    out.clear();
+    for (int i = 0; i < config.count; i++) {
+        Figure figure;
+        figure.type = typeDist(rng);
+        figure.thickness = thicknesses[thicknessDist(rng)];
+        for (int c = 0; c < 3; c++) figure.color[c] = (float)unit(rng);
+
+        Point center(xDist(rng), yDist(rng));
+        figure.points.push_back(center);
+        if (figure.type <= 1) {
+            double angle = 2 * M_PI * unit(rng), length = size();
+            figure.points.push_back(Point(center.x + (int)lround(length * cos(angle)),
+                                          center.y + (int)lround(length * sin(angle))));
+        } else if (figure.type <= 3) {
+            figure.points.push_back(Point(center.x + size(), center.y));
+        } else {
+            figure.points.push_back(Point(center.x + size(), center.y));
+            figure.points.push_back(Point(center.x, center.y + size()));
         }
+        out.push_back(move(figure));
     }
+}
 
-    // Dibujar puntos temporales
-    glColor3f(1.0f, 0.0f, 0.0f);
-    glPointSize(5);
-    glBegin(GL_POINTS);
-    for (int i = 0; i < pointCount; i++) {
-        glVertex2i(tempPoints[i].x, tempPoints[i].y);
+// Opciones comunes de --stress y --stress-scene a partir de argv[first]. El número de
+// figuras es opcional y va primero: una opción en su lugar deja el valor por defecto.
+void parseStressOptions(int argc, char** argv, int first, StressConfig& config) {
+    if (first < argc && argv[first][0] != '-') config.count = atoi(argv[first++]);
+    for (int i = first; i < argc; i++) {
+        if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) config.seed = strtoul(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) config.frames = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--size") == 0 && i + 2 < argc) {
+            config.minSize = atoi(argv[++i]);
+            config.maxSize = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--log") == 0) config.logSizes = true;
     }
-    glEnd();
+}
 
-    if (showCoords) displayCoordinates();
+// Dibuja frames completos (sin la caché de escena) y devuelve sus tiempos en ms
+vector<double> runBenchmark(int frames) {
+    vector<double> times;
+    for (int i = 0; i < frames; i++) {
+        sceneDirty = true;
+        auto start = chrono::steady_clock::now();
+        display();
+        glFinish();
+        times.push_back(elapsedMs(start));
+    }
+    return times;
+}
 
-    glutSwapBuffers();
+void printBenchmark(ostream& out, vector<double> times) {
+    if (times.empty()) return;
+    sort(times.begin(), times.end());
+    size_t p99 = (size_t)ceil(0.99 * times.size()) - 1;
+    out << "Benchmark: " << times.size() << " frames, " << figures.size() << " figuras" << endl;
+    out << "  min " << formatMs(times.front()) << ", mediana " << formatMs(times[times.size() / 2])
+        << ", p99 " << formatMs(times[p99]) << ", max " << formatMs(times.back()) << endl;
 }
 
-void mouse(int button, int state, int x, int y) {
-    if (button == GLUT_LEFT_BUTTON && state == GLUT_DOWN) {
-        mouseX = x; mouseY = y;
+// Reemplaza la escena por una de prueba y mide el dibujado. El reemplazo queda en el
+// historial: deshacer devuelve el dibujo anterior.
+void runStress(const StressConfig& config) {
+    auto start = chrono::steady_clock::now();
+    FigureList scene;
+    generateStressScene(scene, config);
+    cout << "Escena de prueba: " << config.count << " figuras (semilla " << config.seed << ", tamanos "
+         << config.minSize << "-" << config.maxSize << (config.logSizes ? " log" : "") << ") en "
+         << formatMs(elapsedMs(start)) << endl;
 
-        // Convertir coordenadas de ventana a coordenadas OpenGL
-        Point p(x - WIDTH/2, HEIGHT/2 - y);
+    replaceFigures(move(scene));
+    tempPoints.clear();
+    resetView();
+    invalidateScene();
 
-        if (pointCount < 3) {
-            tempPoints[pointCount++] = p;
-        }
+    printBenchmark(cout, runBenchmark(config.frames));
+
+    // Mismo recorrido con un destino que solo cuenta: coste de rasterizar sin OpenGL
+    CountingSink counter;
+    start = chrono::steady_clock::now();
+    for (const auto& figure : figures) drawFigureInView(counter, figure, figure.thickness);
+    cout << "  Rasterizado sin dibujar: " << formatMs(elapsedMs(start)) << ", "
+         << counter.pixels << " pixeles" << endl;
+    printPerf(cout);
+}
 
-        // Verificar si tenemos suficientes puntos para dibujar
-        if ((currentTool <= 1 && pointCount == 2) || // Rectas
-            ((currentTool == 2 || currentTool == 3) && pointCount == 2) || // Círculos
-            (currentTool == 4 && pointCount == 3)) { // Elipses
+// Se lanza desde el bucle de GLUT para que la ventana ya esté visible
+void stressTimer(int) {
+    runStress(stressConfig);
+    exit(0);
+}
 
-            Figure newFig;
-            newFig.type = currentTool;
-            newFig.thickness = currentThickness;
-            memcpy(newFig.color, currentColor, sizeof(currentColor));
+// Comprobación de la elipse de punto medio, sin ventana:
+//   proyecto-DMV-A --check-ellipse
+// - Las versiones int y 64 bits dan los mismos píxeles donde int no desborda.
+// - Radios grandes contra huellas de referencia, obtenidas con una implementación de
+//   la misma recurrencia en aritmética de 128 bits (conjunto de píxeles, cada uno una vez).
+// - Tiempo por píxel de las dos versiones.
+// La huella suma un mezclado de cada píxel: no depende del orden en que el kernel
+// emite las semillas, y los repetidos se detectan en el número de píxeles.
+struct HashSink {
+    unsigned long long hash = 0;
+    long long pixels = 0;
 
-            for (int i = 0; i < pointCount; i++) {
-                newFig.points.push_back(tempPoints[i]);
-            }
+    void plot(int x, int y) {
+        unsigned long long z = (unsigned long long)(unsigned)x << 32 | (unsigned)y;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;  // finalizador de splitmix64
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        hash += z ^ (z >> 31);
+        pixels++;
+    }
+    void plotPoints(const int* xy, int n) {
+        for (int i = 0; i < n; i++) plot(xy[2 * i], xy[2 * i + 1]);
+    }
+};
 
-            figures.push_back(newFig);
-            pointCount = 0;
-        }
+struct EllipseGolden {
+    int rx, ry;
+    long long pixels;
+    unsigned long long hash;
+};
+
+const EllipseGolden ellipseGoldens[] = {
+    {1000, 1000, 5656, 0x4e459fb1c9faaa63ULL},
+    {1000000, 1000000, 5656856, 0x07717e63a3eb34a1ULL},
+    {ELLIPSE_WIDE_LIMIT, ELLIPSE_WIDE_LIMIT, 5931640, 0x85ccdeea00a72330ULL},
+    {ELLIPSE_WIDE_LIMIT, 1, 3632376, 0xdcf6d8a1ce0d0a7eULL},
+    {1, ELLIPSE_WIDE_LIMIT, 4194304, 0x6fc8c1a7463bee6cULL},
+    {999999, 500000, 4472132, 0xca7ca7da4fd977deULL},
+    {1000000, 3, 3944056, 0xb996cb4f213bc0c5ULL},
+};
 
-        glutPostRedisplay();
+// Mejor tiempo de varias pasadas, en nanosegundos por píxel
+template <class Int>
+double timeEllipseKernel(const vector<pair<int, int>>& radii) {
+    double best = 1e30;
+    long long pixels = 0;
+    for (int pass = 0; pass < 5; pass++) {
+        HashSink sink;
+        auto start = chrono::steady_clock::now();
+        for (const auto& r : radii) drawEllipseMidpointKernel<Int>(sink, Point(0, 0), r.first, r.second);
+        best = min(best, elapsedMs(start));
+        pixels = sink.pixels;
     }
+    return pixels > 0 ? best * 1e6 / pixels : 0;
 }
 
-void savePNG(const char* filename, int width, int height) {
-    vector<unsigned char> pixels(3 * width * height);
-    glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+int runEllipseCheck() {
+    int failures = 0;
 
-    // Invertir en vertical
-    vector<unsigned char> flipped(3 * width * height);
-    for (int y = 0; y < height; y++) {
-        memcpy(&flipped[y * width * 3],
-               &pixels[(height - 1 - y) * width * 3],
-               width * 3);
+    long long compared = 0;
+    for (int rx = 1; rx <= 1000; rx++) {
+        for (int ry = 1 + rx % 7; ry <= 1000; ry += 7) {
+            if (!ellipseFitsInt(rx, ry)) continue;
+            HashSink narrow, wide;
+            drawEllipseMidpointKernel<int>(narrow, Point(5, -3), rx, ry);
+            drawEllipseMidpointKernel<long long>(wide, Point(5, -3), rx, ry);
+            compared++;
+            if (narrow.hash != wide.hash || narrow.pixels != wide.pixels) {
+                if (failures++ < 10) cout << "  int y 64 bits difieren con rx=" << rx << " ry=" << ry << endl;
+            }
+        }
     }
+    cout << "int frente a 64 bits: " << compared << " elipses comparadas" << endl;
 
-    int success = stbi_write_png(filename, width, height, 3, flipped.data(), width * 3);
-    if (success) {
-        cout << "Imagen exportada como " << filename << endl;
-    } else {
-        cout << "Error al exportar PNG" << endl;
+    for (const EllipseGolden& golden : ellipseGoldens) {
+        HashSink sink;
+        drawEllipseMidpoint(sink, Point(0, 0), golden.rx, golden.ry);
+        bool ok = sink.pixels == golden.pixels && sink.hash == golden.hash;
+        if (!ok) failures++;
+        cout << "  rx=" << golden.rx << " ry=" << golden.ry << ": " << sink.pixels << " pixeles, huella "
+             << hex << sink.hash << dec << (ok ? "" : "  ERROR") << endl;
+    }
+
+    vector<pair<int, int>> radii;
+    for (int rx = 100; rx <= 400; rx += 20) {
+        for (int ry = 100; ry <= 400; ry += 20) {
+            if (ellipseFitsInt(rx, ry)) radii.push_back(make_pair(rx, ry));
+        }
+    }
+    double narrowNs = timeEllipseKernel<int>(radii), wideNs = timeEllipseKernel<long long>(radii);
+    cout << "Benchmark (" << radii.size() << " elipses): int " << narrowNs << " ns/pixel, 64 bits "
+         << wideNs << " ns/pixel" << endl;
+    vector<pair<int, int>> large = {make_pair(1000000, 1000000), make_pair(1000000, 1000)};
+    cout << "  radios de 1e6 (64 bits): " << timeEllipseKernel<long long>(large) << " ns/pixel" << endl;
+
+    cout << (failures == 0 ? "Elipse correcta" : "Elipse con errores: " + to_string(failures)) << endl;
+    return failures == 0 ? 0 : 1;
+}
+
+// Microbenchmark de las rectas en punto fijo frente a las versiones float:
+//   proyecto-DMV-A --bench-lines [N]
+// N rectas al azar dentro de la ventana (semilla fija), con destino framebuffer y con
+// captura de píxeles (un contador lo vacía el compilador). Antes de medir comprueba que
+// las dos versiones dan los mismos píxeles. Cada tiempo es el mejor de varias pasadas.
+template <class Sink, class Draw>
+double timeLines(Sink& sink, vector<Point>* captured, const vector<pair<Point, Point>>& lines, Draw draw) {
+    double best = 1e30;
+    for (int pass = 0; pass < 3; pass++) {
+        if (captured) captured->clear();  // conserva la capacidad: sin realojar al medir
+        auto start = chrono::steady_clock::now();
+        for (const auto& line : lines) draw(sink, line.first, line.second);
+        best = min(best, elapsedMs(start));
+    }
+    return best;
+}
+
+int runLineBenchmark(int count) {
+    mt19937 rng(1);
+    uniform_int_distribution<int> xDist(-WIDTH/2, WIDTH/2), yDist(-HEIGHT/2, HEIGHT/2);
+    vector<pair<Point, Point>> lines;
+    for (int i = 0; i < count; i++) {
+        Point a(xDist(rng), yDist(rng)), b(xDist(rng), yDist(rng));
+        if (a.x != b.x) lines.push_back(make_pair(a, b));  // las verticales no pasan por ninguna de las dos
     }
+
+    auto slope = [](Point a, Point b) { return float(b.y - a.y) / (b.x - a.x); };
+    auto directFloat = [&](auto& sink, Point a, Point b) {
+        float m = slope(a, b);
+        drawLineDirectFloat(sink, a, b, m, a.y - m * a.x);
+    };
+    auto directFixed = [&](auto& sink, Point a, Point b) {
+        float m = slope(a, b);
+        if (abs(m) <= 1.0f) drawLineDirectShallowFixed(sink, a, b, m, a.y - m * a.x);
+        else drawLineDirectSteepFixed(sink, a, b, m, a.y - m * a.x);
+    };
+    auto steps = [](Point a, Point b) { return max(abs(b.x - a.x), abs(b.y - a.y)); };
+    auto ddaFloat = [&](auto& sink, Point a, Point b) { drawLineDDAFloat(sink, a, b, steps(a, b)); };
+    auto ddaFixed = [&](auto& sink, Point a, Point b) { drawLineDDAFixed(sink, a, b, steps(a, b)); };
+
+    int failures = 0;
+    auto compare = [&](const char* name, auto floatDraw, auto fixedDraw) {
+        HashSink reference, fixed;
+        for (const auto& line : lines) {
+            floatDraw(reference, line.first, line.second);
+            fixedDraw(fixed, line.first, line.second);
+        }
+        bool same = reference.hash == fixed.hash && reference.pixels == fixed.pixels;
+        if (!same) failures++;
+        cout << "  " << name << ": " << reference.pixels << " pixeles" << (same ? ", iguales" : "  ERROR: difieren")
+             << endl;
+    };
+    cout << "Rectas: " << lines.size() << " al azar en la ventana" << endl;
+    compare("directo", directFloat, directFixed);
+    compare("DDA", ddaFloat, ddaFixed);
+
+    Framebuffer fb;
+    clearFramebuffer(fb, WIDTH, HEIGHT);
+    vector<Point> captured;
+    auto bench = [&](const char* name, auto floatDraw, auto fixedDraw) {
+        FramebufferSink<true> framebuffer(fb);
+        CaptureSink capture(captured);
+        double floatFb = timeLines(framebuffer, nullptr, lines, floatDraw);
+        double fixedFb = timeLines(framebuffer, nullptr, lines, fixedDraw);
+        double floatCapture = timeLines(capture, &captured, lines, floatDraw);
+        double fixedCapture = timeLines(capture, &captured, lines, fixedDraw);
+        cout << "  " << name << ", framebuffer: float " << formatMs(floatFb) << ", punto fijo " << formatMs(fixedFb)
+             << endl;
+        cout << "  " << name << ", captura: float " << formatMs(floatCapture) << ", punto fijo "
+             << formatMs(fixedCapture) << endl;
+    };
+    bench("directo", directFloat, directFixed);
+    bench("DDA", ddaFloat, ddaFixed);
+    return failures == 0 ? 0 : 1;
 }
 
 void keyboard(unsigned char key, int x, int y) {
     switch (key) {
         case 'g': case 'G':
             showGrid = !showGrid;
+            invalidateScene();
             break;
         case 'e': case 'E':
             showAxes = !showAxes;
+            invalidateScene();
             break;
         case 'c': case 'C':
-            figures.clear();
-            pointCount = 0;
+            clearFigures();
+            tempPoints.clear();
             break;
         case 'z': case 'Z':
-            if (!figures.empty()) {
-                undoStack.push_back(figures.back());
-                figures.pop_back();
-            }
+            undo();
             break;
         case 'y': case 'Y':
-            if (!undoStack.empty()) {
-                figures.push_back(undoStack.back());
-                undoStack.pop_back();
-            }
+            redo();
+            break;
+        case 'p': case 'P':
+            printPerf(cout);
+            return;
+        case '+':
+            zoomAt(0, 0, ZOOM_STEP);
+            break;
+        case '-':
+            zoomAt(0, 0, 1 / ZOOM_STEP);
+            break;
+        case '0':
+            resetView();
+            break;
+        case 13: // Intro: terminar polilínea, curva o polígono
+            finishTempFigure();
+            break;
+        case 27: // Esc: descartar los puntos en construcción
+            tempPoints.clear();
+            break;
+        case 8: case 127: // Retroceso / Supr: borrar la figura seleccionada
+            if (selectedFigure >= 0) removeFigure(selectedFigure);
             break;
         case 's': case 'S':
         cout << "Exportando imagen..." << endl;
         savePNG("C:/Users/Usuario/Desktop/captura.png", WIDTH, HEIGHT);
    // ✅ Exportar como PNG
-        break;
-
+        return;
 
+        default:
+            return;  // tecla sin efecto: no hace falta redibujar
         }
-        glutPostRedisplay();
+        requestRedisplay();
+}
+
+void specialKeys(int key, int x, int y) {
+    switch (key) {
+        case GLUT_KEY_LEFT: panView(PAN_STEP, 0); break;
+        case GLUT_KEY_RIGHT: panView(-PAN_STEP, 0); break;
+        case GLUT_KEY_UP: panView(0, -PAN_STEP); break;
+        case GLUT_KEY_DOWN: panView(0, PAN_STEP); break;
+        default: return;
+    }
+    requestRedisplay();
 }
 
 // Menús
@@ -410,8 +4584,9 @@ void mainMenu(int value) {
 
 void drawingMenu(int value) {
     currentTool = value;
-    pointCount = 0;
+    tempPoints.clear();
     cout << "Tool selected: " << value << endl;
+    requestRedisplay();  // quita la vista previa pendiente
 }
 
 void colorMenu(int value) {
@@ -438,26 +4613,54 @@ void thicknessMenu(int value) {
 
 void viewMenu(int value) {
     switch (value) {
-        case 0: showGrid = !showGrid; break;
-        case 1: showAxes = !showAxes; break;
+        case 0: showGrid = !showGrid; invalidateScene(); break;
+        case 1: showAxes = !showAxes; invalidateScene(); break;
         case 2: showCoords = !showCoords; break;
+        case 3: showPerf = !showPerf; break;
     }
+    requestRedisplay();
 }
 
 void toolsMenu(int value) {
     switch (value) {
-        case 0: figures.clear(); pointCount = 0; break;  // Limpiar lienzo
-        case 1: // Borrar última figura
-            if (!figures.empty()) {
-                undoStack.push_back(figures.back());
-                figures.pop_back();
-            }
+        case 0: clearFigures(); tempPoints.clear(); break;  // Limpiar lienzo
+        case 1: // Deshacer
+            undo();
             break;
+        // Exportar y guardar no cambian la imagen: no se pide redibujar
         case 2: // Exportar imagen
             savePNG("captura.png", WIDTH, HEIGHT);
+            return;
+        case 3: // Exportar imagen con paleta
+            savePNG("captura.png", WIDTH, HEIGHT, true);
+            return;
+        case 4: // Exportar SVG vectorial
+            saveSVG("captura.svg", false);
+            return;
+        case 5: // Exportar SVG con los píxeles de cada algoritmo
+            saveSVG("captura.svg", true);
+            return;
+        case 6: // Guardar escena
+            if (saveScene("escena.txt", figures, showGrid, showAxes)) cout << "Escena guardada en escena.txt" << endl;
+            else cout << "Error al guardar la escena" << endl;
+            return;
+        case 7: // Cargar escena
+            if (loadScene("escena.txt", figures, showGrid, showAxes)) {
+                historyReset();
+                pickIndex = PickIndex();
+                selectedFigure = -1;
+                invalidateScene();
+                tempPoints.clear();
+                cout << "Escena cargada de escena.txt" << endl;
+            } else {
+                cout << "Error al cargar la escena" << endl;
+            }
+            break;
+        case 8: // Escena de prueba con la configuración por defecto
+            runStress(StressConfig());
             break;
     }
-    glutPostRedisplay();
+    requestRedisplay();
 }
 
 
@@ -470,6 +4673,13 @@ void helpMenu(int value) {
         cout << "Z - Deshacer" << endl;
         cout << "Y - Rehacer" << endl;
         cout << "S - Exportar imagen" << endl;
+        cout << "P - Mostrar contadores de rendimiento" << endl;
+        cout << "Supr - Borrar la figura seleccionada" << endl;
+        cout << "Intro - Terminar polilinea, curva Bezier o poligono" << endl;
+        cout << "Esc - Descartar los puntos en construccion" << endl;
+        cout << "Rueda / + / - - Acercar o alejar" << endl;
+        cout << "Boton central / flechas - Desplazar la vista" << endl;
+        cout << "0 - Restablecer la vista" << endl;
     }
 }
 
@@ -480,6 +4690,15 @@ void createMenu() {
     glutAddMenuEntry("Circulo (Incremental)", 2);
     glutAddMenuEntry("Circulo (Punto Medio)", 3);
     glutAddMenuEntry("Elipse (Punto Medio)", 4);
+    glutAddMenuEntry("Polilinea (Intro para terminar)", POLYLINE_TYPE);
+    glutAddMenuEntry("Curva Bezier (Intro para terminar)", BEZIER_TYPE);
+    glutAddMenuEntry("Poligono relleno par-impar (Intro para terminar)", POLYGON_EVEN_ODD_TYPE);
+    glutAddMenuEntry("Poligono relleno no nulo (Intro para terminar)", POLYGON_NONZERO_TYPE);
+    glutAddMenuEntry("Cubeta (rellenar region)", FLOOD_FILL_TYPE);
+    glutAddMenuEntry("Elipse girada (centro, eje, ancho)", ROTATED_ELLIPSE_TYPE);
+    glutAddMenuEntry("Arco de circunferencia (centro, inicio, fin)", CIRCLE_ARC_TYPE);
+    glutAddMenuEntry("Arco de elipse (elipse, inicio, fin)", ELLIPSE_ARC_TYPE);
+    glutAddMenuEntry("Seleccionar", SELECT_TOOL);
 
     int colorSubMenu = glutCreateMenu(colorMenu);
     glutAddMenuEntry("Negro", 0);
@@ -498,11 +4717,18 @@ void createMenu() {
     glutAddMenuEntry("Mostrar/Ocultar cuadricula", 0);
     glutAddMenuEntry("Mostrar/Ocultar ejes", 1);
     glutAddMenuEntry("Mostrar coordenadas", 2);
+    glutAddMenuEntry("Mostrar rendimiento", 3);
 
     int toolsSubMenu = glutCreateMenu(toolsMenu);
     glutAddMenuEntry("Limpiar lienzo", 0);
     glutAddMenuEntry("Deshacer", 1);
     glutAddMenuEntry("Exportar imagen (PNG)", 2);
+    glutAddMenuEntry("Exportar imagen (PNG indexado)", 3);
+    glutAddMenuEntry("Exportar SVG (vectorial)", 4);
+    glutAddMenuEntry("Exportar SVG (pixeles exactos)", 5);
+    glutAddMenuEntry("Guardar escena", 6);
+    glutAddMenuEntry("Cargar escena", 7);
+    glutAddMenuEntry("Escena de prueba (benchmark)", 8);
 
     int helpSubMenu = glutCreateMenu(helpMenu);
     glutAddMenuEntry("Atajos de teclado", 0);
@@ -525,11 +4751,61 @@ void init() {
     glLoadIdentity();
     gluOrtho2D(-WIDTH/2, WIDTH/2, -HEIGHT/2, HEIGHT/2);
     glMatrixMode(GL_MODELVIEW);
+
+    // Textura donde se guarda la escena rasterizada
+    glGenTextures(1, &sceneTexture);
+    glBindTexture(GL_TEXTURE_2D, sceneTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, WIDTH, HEIGHT, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    buildGlyphAtlas();
 }
 
 
 int main(int argc, char** argv) {
+#ifdef DMV_TRACE
+    atexit(traceWrite);
+#endif
+
+    // Modo por lotes: no abre ventana ni necesita contexto OpenGL
+    if (argc >= 3 && strcmp(argv[1], "--batch") == 0) {
+        int threads = 0;
+        bool indexed = false;
+        for (int i = 3; i < argc; i++) {
+            if (strcmp(argv[i], "--indexed") == 0) indexed = true;
+            else threads = atoi(argv[i]);
+        }
+        return runBatch(argv[2], threads, indexed);
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "--check-ellipse") == 0) return runEllipseCheck();
+    if (argc >= 2 && strcmp(argv[1], "--bench-lines") == 0) return runLineBenchmark(argc >= 3 ? atoi(argv[2]) : 200000);
+
+    // Guarda la escena de prueba sin abrir ventana (entrenamiento PGO con --batch)
+    if (argc >= 3 && strcmp(argv[1], "--stress-scene") == 0) {
+        parseStressOptions(argc, argv, 3, stressConfig);
+        generateStressScene(figures, stressConfig);
+        if (!saveScene(argv[2], figures, false, false)) {
+            cerr << "No se pudo guardar la escena " << argv[2] << endl;
+            return 1;
+        }
+        cout << "Escena de prueba: " << figures.size() << " figuras en " << argv[2] << endl;
+        return 0;
+    }
+
     glutInit(&argc, argv);
+
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "--autosave") == 0) autosavePath = argv[i + 1];
+    }
+
+    // Escena de prueba y benchmark: se ejecuta al arrancar el bucle y termina
+    if (argc >= 2 && strcmp(argv[1], "--stress") == 0) {
+        stressRequested = true;
+        parseStressOptions(argc, argv, 2, stressConfig);
+    }
     glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB);
     glutInitWindowSize(WIDTH, HEIGHT);
     glutInitWindowPosition(100, 100);
@@ -541,9 +4817,25 @@ int main(int argc, char** argv) {
     glutDisplayFunc(display);
     glutMouseFunc(mouse);
     glutKeyboardFunc(keyboard);
+    glutSpecialFunc(specialKeys);
+    if (autosavePath) {
+        atexit(autosaveFinish);
+        glutTimerFunc(AUTOSAVE_MS, autosave, 0);
+    }
+    if (stressRequested) glutTimerFunc(0, stressTimer, 0);
     glutPassiveMotionFunc([](int x, int y) {
         mouseX = x; mouseY = y;
-        if (showCoords) glutPostRedisplay();
+        if (cursorChangesFrame()) requestRedisplay();
+    });
+    glutMotionFunc([](int x, int y) {
+        mouseX = x; mouseY = y;
+        if (panning) {
+            panView(x - panX, panY - y);
+            panX = x; panY = y;
+            requestRedisplay();
+        } else if (cursorChangesFrame()) {
+            requestRedisplay();
+        }
     });
 
     cout << "CAD 2D Basic inicializado" << endl;